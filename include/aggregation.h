@@ -0,0 +1,33 @@
+/*
+ * File: aggregation.h
+ * Description: Aggregation task, on the application core next to the
+ *              sampling task (see task_layout.h). It takes every snapshot
+ *              the sampling task queues, records it in the history and the
+ *              rollups, and queues those outside the deadband for the
+ *              network task to publish.
+ */
+
+#ifndef AGGREGATION_H
+#define AGGREGATION_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stddef.h>
+
+#include "sensor_snapshot.h"
+
+// Readings waiting for the network task. While it is busy (e.g. a broker
+// connection attempt) the newest ones are dropped once it is full.
+// A power of two, see spsc_queue.h.
+const size_t REPORT_QUEUE_SIZE = 16;
+
+// Start the aggregation task. `network` is notified (xTaskNotifyGive)
+// whenever a reading is queued for it. Call once the history and the
+// rollup store are set up.
+void startAggregationTask(TaskHandle_t network);
+
+// Take the oldest reading to publish. Call from the network task only.
+// Returns false when there is none.
+bool takeReport(SensorSnapshot &reading);
+
+#endif  // AGGREGATION_H
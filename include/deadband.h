@@ -0,0 +1,46 @@
+/*
+ * File: deadband.h
+ * Description: Report-by-exception filter for the published readings.
+ *              A reading is only published when one of its values moved by
+ *              more than a threshold since the last published one, or when
+ *              the heartbeat interval has elapsed, so that flat readings
+ *              don't load the broker and the time-series database.
+ */
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+// Default thresholds, e.g. -D DEADBAND_TEMPERATURE=0.3. A threshold of 0
+// disables the deadband for that value: every reading is published.
+// They can be changed at runtime, see runtime_config.h
+#ifndef DEADBAND_TEMPERATURE
+#define DEADBAND_TEMPERATURE 0.0f
+#endif
+#ifndef DEADBAND_HUMIDITY
+#define DEADBAND_HUMIDITY 0.0f
+#endif
+#ifndef DEADBAND_HEARTBEAT_MS
+#define DEADBAND_HEARTBEAT_MS 300000
+#endif
+
+struct DeadbandConfig {
+    float temperature;     // Minimum change of the temperature, in Celsius
+    float humidity;        // Minimum change of the humidity, in %
+    uint32_t heartbeatMs;  // Maximum time between two published readings
+};
+
+// Whether `reading` must be published, with the thresholds of the current
+// runtime config, compared to the last reading passed to markReported()
+bool reportDue(const SensorSnapshot &reading);
+
+// Remember `reading` as the last published reading of its sensor. Call
+// only once it is on its way, so that a reading dropped before that stays
+// due and the next one is compared to what was really published.
+void markReported(const SensorSnapshot &reading);
+
+#endif  // DEADBAND_H
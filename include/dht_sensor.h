@@ -0,0 +1,36 @@
+/*
+ * File: dht_sensor.h
+ * Description: DHT11/DHT22 single-wire sensor, through the Adafruit library.
+ */
+
+#ifndef DHT_SENSOR_H
+#define DHT_SENSOR_H
+
+#include <Adafruit_Sensor.h>
+#include <DHT.h>
+
+#include "polled_sensor.h"
+
+class DhtSensor : public PolledSensor {
+   public:
+    // `type` is DHT11 or DHT22
+    DhtSensor(uint8_t pin, uint8_t type) : dht(pin, type) {}
+
+    void begin() override { dht.begin(); }
+
+    // Force one transaction; the two getters below then return the values
+    // decoded from it instead of talking to the sensor again
+    SampleStatus readSample(Sample &sample) override {
+        if (!dht.read(true)) {
+            return SAMPLE_ERROR;
+        }
+        sample.temperature = dht.readTemperature();
+        sample.humidity = dht.readHumidity();
+        return SAMPLE_OK;
+    }
+
+   private:
+    DHT dht;
+};
+
+#endif  // DHT_SENSOR_H
@@ -0,0 +1,46 @@
+/*
+ * File: discovery.h
+ * Description: mDNS responder and DNS-SD services, so that collectors find
+ *              the nodes on the local network instead of relying on static
+ *              DHCP reservations. The device answers as "<hostname>.local"
+ *              and advertises the dashboard as an _http._tcp service, and
+ *              itself as an _esp32-dht._tcp service whose TXT records tell
+ *              where its data is:
+ *
+ *                id        deviceId(), e.g. "e5d4c3b2a124"
+ *                prefix    MQTT topic prefix of the first sensor
+ *                sensors   number of sensors
+ *                config    retained config topic, see runtime_config.h
+ *                readings, history, events, metrics   HTTP routes
+ *
+ *              The same responder resolves ".local" broker names, see
+ *              mqtt_connection.h.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stdint.h>
+
+// DNS-SD type of the service describing the node, "_esp32-dht._tcp"
+// (the underscore is added by the responder)
+const char *const DISCOVERY_SERVICE_TYPE = "esp32-dht";
+
+// Port of the web server, advertised by both services
+const uint16_t WEB_SERVER_PORT = 80;
+
+// Host name of the device, without ".local": MDNS_HOSTNAME if set, e.g.
+// -D MDNS_HOSTNAME=\"greenhouse\", otherwise "esp32-" and its deviceId().
+// It is also the name given to the DHCP server.
+const char *discoveryHostname();
+
+// Start the mDNS responder, if not started yet. Needs the Wi-Fi link; the
+// responder follows it by itself afterwards. Returns false if it could not
+// be started.
+bool beginMdns();
+
+// Start the responder and advertise the services. Call once, after the
+// Wi-Fi link is up.
+void setupDiscovery();
+
+#endif  // DISCOVERY_H
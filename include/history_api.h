@@ -0,0 +1,38 @@
+/*
+ * File: history_api.h
+ * Description: GET /api/history, the min/max/mean/count of the readings of
+ *              one sensor over a time range, in buckets of a given length:
+ *
+ *                /api/history?sensor=0&from=<unix>&to=<unix>&step=<s>
+ *                            &format=json|csv
+ *
+ *              Every parameter is optional: the last day of the first
+ *              sensor by hour, as JSON, by default. Buckets are aligned on
+ *              multiples of `step` and empty ones are left out. Steps of
+ *              whole hours are served from the hourly rollups, others from
+ *              the history samples. Either way the response is chunked and
+ *              generated a few buckets at a time, as the client reads it.
+ */
+
+#ifndef HISTORY_API_H
+#define HISTORY_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class AsyncWebServer;
+
+// Defaults of `to` - `from` and `step`, in seconds
+const uint32_t HISTORY_DEFAULT_RANGE_S = 24 * 3600;
+const uint32_t HISTORY_DEFAULT_STEP_S = 3600;
+
+// Shortest bucket, in seconds
+const uint32_t HISTORY_MIN_STEP_S = 60;
+
+// Buckets aggregated at a time, for each chunk of the response
+const size_t HISTORY_CHUNK_BUCKETS = 16;
+
+// Register GET /api/history on `server`
+void setupHistoryApi(AsyncWebServer &server);
+
+#endif  // HISTORY_API_H
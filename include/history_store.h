@@ -0,0 +1,62 @@
+/*
+ * File: history_store.h
+ * Description: On-device history of the readings, kept in flash for days.
+ *              Samples are compressed Gorilla-style (delta-of-delta Unix
+ *              times, deltas of the values) into fixed-size pages, which
+ *              are written in rotation to a ring file on LittleFS: every
+ *              page slot is rewritten once per lap, and there is no
+ *              header that changes on every write.
+ */
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history_codec.h"
+#include "sampling.h"
+
+// Number of page slots in the ring file, e.g. -D HISTORY_PAGES=512.
+// A page holds a few hundred samples when the readings are steady, so the
+// default 128 KB keep several days of one sensor read every 3 seconds.
+#ifndef HISTORY_PAGES
+#define HISTORY_PAGES 256
+#endif
+
+// Values are stored in tenths of a degree / percent
+const float HISTORY_RESOLUTION = 0.1f;
+
+// The page being filled is written every this often, so a power cut loses
+// at most this much history
+const uint32_t HISTORY_FLUSH_INTERVAL_MS = 15 * 60 * 1000UL;
+
+struct HistorySample {
+    uint32_t epoch;  // Unix time
+    float temperature;
+    float humidity;
+};
+
+// Called for every sample of a range, oldest first.
+// Return false to stop early.
+typedef bool (*HistoryVisitor)(const HistorySample &sample, void *context);
+
+// Open the ring file, creating it on the first boot. Call after
+// setupPublishQueue(), which mounts LittleFS.
+void setupHistory();
+
+// Add the filtered values of `reading` to the history of its sensor.
+// Readings without a Unix time and failed reads (!sensorOk) are skipped.
+// Call from the aggregation task.
+void recordHistory(const SensorSnapshot &reading);
+
+// Write the pages being filled to flash, e.g. before a restart
+void flushHistory();
+
+// Visit the samples of `sensor` taken between `from` and `to` (Unix times,
+// inclusive), flash first, then the page being filled. Safe to call from
+// any task. Returns the number of samples visited.
+size_t readHistory(uint8_t sensor, uint32_t from, uint32_t to,
+                   HistoryVisitor visitor, void *context);
+
+#endif  // HISTORY_STORE_H
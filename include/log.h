@@ -0,0 +1,85 @@
+/*
+ * File: log.h
+ * Description: Leveled logging macros. Messages below LOG_LEVEL are
+ *              compiled out entirely; the others are formatted into a ring
+ *              buffer and written to Serial by a low-priority task, so the
+ *              callers never wait for the UART.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+// Log levels, from the quietest to the most verbose
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Level compiled in, e.g. -D LOG_LEVEL=LOG_LEVEL_NONE. Debug messages are
+// only kept in PlatformIO debug builds (build_type = debug).
+#ifndef LOG_LEVEL
+#ifdef __PLATFORMIO_BUILD_DEBUG__
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// Size of the ring buffer holding messages not yet written, in bytes.
+// When it is full new messages are dropped (and counted).
+const size_t LOG_BUFFER_SIZE = 2048;
+
+// Longest message, prefix included; longer ones are truncated
+const size_t LOG_MAX_MESSAGE_SIZE = 160;
+
+// Start the task writing the buffered messages to Serial. Until it runs,
+// messages are written to Serial directly.
+void startLogger();
+
+// Format and queue a message. `level` is the letter shown in the prefix.
+// Use the LOG_* macros instead of calling it directly.
+void logMessage(char level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logMessage('E', __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logMessage('W', __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logMessage('I', __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logMessage('D', __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+// Run a LOG_* statement at most once every `intervalMs` for this call
+// site, e.g. LOG_EVERY(10000, LOG_WARN("Sensor read failed"));
+#define LOG_EVERY(intervalMs, statement)                            \
+    do {                                                            \
+        static unsigned long lastLogTime_ = 0;                      \
+        static bool loggedOnce_ = false;                            \
+        unsigned long now_ = millis();                              \
+        if (!loggedOnce_ || now_ - lastLogTime_ >= (intervalMs)) {  \
+            loggedOnce_ = true;                                     \
+            lastLogTime_ = now_;                                    \
+            statement;                                              \
+        }                                                           \
+    } while (0)
+
+#endif  // LOG_H
@@ -0,0 +1,106 @@
+/*
+ * File: metrics.h
+ * Description: Counters and histograms describing the firmware's own
+ *              performance, exported in the Prometheus text format by the
+ *              /metrics route. Updates are relaxed atomic increments on a
+ *              static struct, cheap enough for the hot paths.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Print.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-bucket histogram of durations, in microseconds.
+// Bucket i counts the observations <= bounds[i]; the +Inf bucket is `count`.
+// The sum wraps after about 71 minutes of accumulated time, which Prometheus
+// treats like a counter reset.
+template <size_t N>
+class Histogram {
+   public:
+    explicit Histogram(const uint32_t (&bounds)[N]) : bounds(bounds) {}
+
+    void observe(uint32_t valueUs) {
+        for (size_t i = 0; i < N; i++) {
+            if (valueUs <= bounds[i]) {
+                buckets[i].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        sumUs.fetch_add(valueUs, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Write the histogram as `name`, in seconds, with optional extra labels
+    // (e.g. "route=\"/\"") added to every sample
+    void write(Print &out, const char *name, const char *labels = "") const;
+
+   private:
+    const uint32_t (&bounds)[N];
+    std::atomic<uint32_t> buckets[N] = {};
+    std::atomic<uint32_t> sumUs{0};
+    std::atomic<uint32_t> count{0};
+};
+
+// Routes served by the web server, to count requests per route
+enum HttpRoute {
+    ROUTE_INDEX,
+    ROUTE_TEMPERATURE,
+    ROUTE_HUMIDITY,
+    ROUTE_API_READINGS,
+    ROUTE_API_HISTORY,
+    ROUTE_EVENTS,
+    ROUTE_METRICS,
+    ROUTE_UPDATE,
+    ROUTE_COUNT
+};
+
+// Path of each route, e.g. "/api/readings"
+extern const char *HTTP_ROUTE_NAMES[ROUTE_COUNT];
+
+// Bucket bounds, in microseconds
+constexpr uint32_t DHT_READ_BUCKETS_US[] = {1000,  2500,  5000,
+                                            10000, 25000, 100000};
+constexpr uint32_t PUBLISH_BUCKETS_US[] = {100,  250,   500,   1000,
+                                           5000, 10000, 50000, 250000};
+constexpr uint32_t LOOP_BUCKETS_US[] = {50,    100,   250,    500,    1000,
+                                        10000, 50000, 250000, 1000000};
+
+struct Metrics {
+    Histogram<6> dhtReadDuration{DHT_READ_BUCKETS_US};
+    std::atomic<uint32_t> dhtReadFailures{0};
+    std::atomic<uint32_t> spikesRejected{0};
+
+    Histogram<8> mqttPublishDuration{PUBLISH_BUCKETS_US};
+    std::atomic<uint32_t> mqttPublishSuccesses{0};
+    std::atomic<uint32_t> mqttPublishFailures{0};
+    std::atomic<uint32_t> mqttReconnectAttempts{0};
+
+    std::atomic<uint32_t> httpRequests[ROUTE_COUNT] = {};
+
+    Histogram<9> loopDuration{LOOP_BUCKETS_US};
+
+    // Elements that did not fit in the queues between the tasks
+    std::atomic<uint32_t> samplesDropped{0};
+    std::atomic<uint32_t> reportsDropped{0};
+    std::atomic<uint32_t> rollupsDropped{0};
+
+    // Readings the publish queue could not keep in flash because the clock
+    // was not set yet: their time would mean nothing after a reboot
+    std::atomic<uint32_t> unsyncedDropped{0};
+};
+
+extern Metrics metrics;
+
+// Shorthand for the hot paths
+inline void countMetric(std::atomic<uint32_t> &counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Write every metric, plus the heap gauges, in the Prometheus text format
+void writeMetrics(Print &out);
+
+#endif  // METRICS_H
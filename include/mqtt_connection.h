@@ -0,0 +1,117 @@
+/*
+ * File: mqtt_connection.h
+ * Description: Connection to the MQTT broker. maintainMqtt() services the
+ *              client on every network task round and reconnects with
+ *              backoff. Only a PubSubClient connection attempt blocks, see
+ *              maintainMqtt().
+ *
+ *              By default messages are sent with QoS 0 through PubSubClient.
+ *              With -D MQTT_QOS=1 (env:esp32doit-devkit-v1-qos1) they are
+ *              sent with QoS 1 through AsyncMqttClient instead: up to
+ *              MQTT_INFLIGHT_WINDOW messages may wait for their PUBACK at
+ *              the same time, and the ones still waiting when the
+ *              connection drops are sent again after reconnecting.
+ *
+ *              The broker may be given as an IP address, a host name
+ *              (resolved with DNS) or an mDNS name such as "broker.local".
+ *              Names are looked up by the resolver task (see
+ *              task_layout.h), so a lookup never stalls maintainMqtt().
+ *              The address is kept for the next attempts, across deep
+ *              sleeps in low-power mode, until MQTT_RESOLVE_AFTER_FAILURES
+ *              of them failed in a row.
+ */
+
+#ifndef MQTT_CONNECTION_H
+#define MQTT_CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "payload.h"
+#include "publish_queue.h"
+
+#ifndef MQTT_QOS
+#define MQTT_QOS 0
+#endif
+
+// Messages sent but not acknowledged yet, with MQTT_QOS 1. Each one keeps
+// a copy of the message until its PUBACK, in case it must be sent again.
+#ifndef MQTT_INFLIGHT_WINDOW
+#define MQTT_INFLIGHT_WINDOW 8
+#endif
+
+// Delay between MQTT reconnection attempts: starts at 1 second and doubles
+// after every failure, up to 1 minute
+const uint32_t MQTT_RETRY_BASE_MS = 1000;
+const uint32_t MQTT_RETRY_MAX_MS = 60000;
+
+// Give up on an asynchronous connection attempt after this long
+const uint32_t MQTT_CONNECT_TIMEOUT_MS = 5000;
+
+// Longest wait for the CONNACK of a PubSubClient (QoS 0) connection
+// attempt, which is synchronous, in seconds
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 2;
+
+// Longest wait of the resolver task for the answer to an mDNS query for
+// the broker
+const uint32_t MQTT_MDNS_TIMEOUT_MS = 2000;
+
+// The name of the broker is resolved again after this many failed
+// connection attempts in a row, in case its address changed
+const uint32_t MQTT_RESOLVE_AFTER_FAILURES = 3;
+
+// Largest message the firmware sends (a full batch) and receives (config
+// and update requests), and longest topic
+const size_t MQTT_MAX_MESSAGE_SIZE = MAX_PAYLOAD_SIZE * MAX_BATCH_SAMPLES;
+const size_t MQTT_MAX_INBOUND_SIZE = 256;
+const size_t MQTT_MAX_TOPIC_SIZE = 64;
+
+// Called once connected, e.g. to subscribe
+typedef void (*MqttConnectHandler)();
+
+// Called from maintainMqtt() for every message received from the broker
+typedef void (*MqttMessageHandler)(const char *topic, const uint8_t *payload,
+                                   size_t length);
+
+// Set up the client. `host` is an IP address, a host name or an mDNS name
+// and must stay valid. Nothing is attempted (nor resolved) until
+// maintainMqtt() or connectMqtt() is called. Either handler may be null.
+void beginMqtt(const char *host, uint16_t port, const char *clientId,
+               MqttConnectHandler onConnect, MqttMessageHandler onMessage);
+
+// Service the client (keepalives, incoming messages, acknowledgements) and
+// reconnect when needed. Call on every network task round. It returns
+// right away, name lookups included, except on a round that starts a
+// connection attempt with QoS 0. That round stalls the caller until the
+// attempt succeeds or fails: at worst the TCP connect timeout of
+// WiFiClient (3 s by default) plus MQTT_SOCKET_TIMEOUT_S, about 5 s
+// against an unreachable broker. Nothing is attempted while the Wi-Fi
+// link is down.
+void maintainMqtt();
+
+// Connect, waiting for at most `timeoutMs` (low-power mode).
+// Returns true once connected.
+bool connectMqtt(uint32_t timeoutMs);
+
+bool mqttConnected();
+
+bool mqttSubscribe(const char *topic);
+
+// Publish a message, keeping track of the outcome and of the time it took.
+// With QoS 1 it returns true once the message is in the in-flight window;
+// it is delivered at least once from then on, unless the device resets.
+bool mqttPublish(const char *topic, const uint8_t *payload, size_t length);
+bool mqttPublish(const char *topic, const char *payload);
+
+// How many messages can be published right now without being refused
+// because the in-flight window is full. SIZE_MAX with QoS 0.
+size_t mqttPublishCapacity();
+
+// Wait until every message sent so far has been acknowledged (QoS 1) or
+// handed to the network stack (QoS 0), for at most `timeoutMs`.
+// Returns false on a timeout.
+bool flushMqtt(uint32_t timeoutMs);
+
+void disconnectMqtt();
+
+#endif  // MQTT_CONNECTION_H
@@ -0,0 +1,55 @@
+/*
+ * File: ota_update.h
+ * Description: Over-the-air firmware updates, either uploaded to the web
+ *              server (POST /update, multipart form) or pulled over HTTP
+ *              when asked to on MQTT. Both need OTA_PASSWORD. Either way
+ *              the image is streamed into the inactive OTA partition chunk
+ *              by chunk, as it arrives, and never held in RAM; the device
+ *              restarts into it once it has been written and verified.
+ */
+
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class AsyncWebServer;
+
+// Credentials of the upload endpoint (HTTP basic authentication), e.g.
+// -D OTA_PASSWORD=\"secret\". The password is also required in MQTT pull
+// requests. Without a password neither way is compiled in.
+#ifndef OTA_USERNAME
+#define OTA_USERNAME "admin"
+#endif
+
+// Size of the buffer the HTTP pull reads into before each flash write
+const size_t OTA_CHUNK_SIZE = 1024;
+
+// Give up on a pull when no data arrived for this long
+const uint32_t OTA_STALL_TIMEOUT_MS = 15000;
+
+// Time left to the last HTTP response or log line before restarting
+const uint32_t OTA_RESTART_DELAY_MS = 1000;
+
+// Register POST /update on `server`, if OTA_PASSWORD is set
+void setupWebOta(AsyncWebServer &server);
+
+#ifdef OTA_PASSWORD
+// Start pulling the image described by a (NUL-terminated) JSON object such
+// as {"url":"http://10.0.0.2/firmware.bin","md5":"<32 hex digits>",
+// "password":"secret"}. The password must be OTA_PASSWORD, and the MD5 is
+// required: the image is only booted if it matches. Returns false, before
+// downloading anything, if the message is invalid or an update is already
+// running.
+bool startHttpOta(const char *json);
+
+// Topic on which startHttpOta() requests are received, next to the
+// runtime config, e.g. "esp32/e5d4c3b2a124/ota"
+const char *otaTopic();
+#endif
+
+// Restart once an update has been written. Call on every network task round.
+void maintainOta();
+
+#endif  // OTA_UPDATE_H
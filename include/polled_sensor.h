@@ -0,0 +1,37 @@
+/*
+ * File: polled_sensor.h
+ * Description: Common interface of the temperature and humidity sensors
+ *              read by the sampling task. Each read may run a blocking bus
+ *              transaction, so the task spreads them out over time.
+ */
+
+#ifndef POLLED_SENSOR_H
+#define POLLED_SENSOR_H
+
+// Outcome of one sensor transaction
+enum SampleStatus {
+    SAMPLE_OK,
+    SAMPLE_TIMEOUT,         // The sensor did not answer
+    SAMPLE_CHECKSUM_ERROR,  // The frame was corrupted
+    SAMPLE_ERROR,           // Any other failure reported by the driver
+};
+
+// Both values measured by one transaction
+struct Sample {
+    float temperature;  // Celsius
+    float humidity;     // Relative humidity in %
+};
+
+class PolledSensor {
+   public:
+    virtual ~PolledSensor() {}
+
+    // Prepare the sensor and its bus
+    virtual void begin() = 0;
+
+    // Run one transaction and fill `sample` with both values. `sample` is
+    // only meaningful when SAMPLE_OK is returned.
+    virtual SampleStatus readSample(Sample &sample) = 0;
+};
+
+#endif  // POLLED_SENSOR_H
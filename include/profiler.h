@@ -0,0 +1,72 @@
+/*
+ * File: profiler.h
+ * Description: Latency profiling of the hot paths, built with -D PROFILE
+ *              (env:esp32doit-devkit-v1-profile). Each instrumented scope
+ *              is timed with esp_timer_get_time() into a fixed-size
+ *              histogram, and the percentiles are logged every
+ *              PROFILE_DUMP_INTERVAL_MS together with the heap
+ *              fragmentation. Without PROFILE the macros compile to
+ *              nothing.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include "metrics.h"
+
+// How often the percentiles are logged, and then reset
+#ifndef PROFILE_DUMP_INTERVAL_MS
+#define PROFILE_DUMP_INTERVAL_MS 10000
+#endif
+
+// What is timed
+enum ProfilePoint {
+    PROFILE_LOOP,           // One round of the network task
+    PROFILE_SAMPLING,       // One reading, from the sensor to its snapshot
+    PROFILE_SAMPLE_PERIOD,  // Time between two wake-ups of the sampling task
+    PROFILE_AGGREGATION,    // One snapshot through the aggregation task
+    PROFILE_MQTT_PUBLISH,   // One mqttPublish() call
+    PROFILE_HTTP_FIRST,     // One handler call per route, see HttpRoute
+    PROFILE_POINTS = PROFILE_HTTP_FIRST + ROUTE_COUNT
+};
+
+#ifdef PROFILE
+#include <esp_timer.h>
+
+// Add a duration to the histogram of `point`. Safe to call from any task.
+void profileRecord(int point, uint32_t durationUs);
+
+// Times the enclosing scope
+class ProfileScope {
+   public:
+    explicit ProfileScope(int point)
+        : point(point), start(esp_timer_get_time()) {}
+    ~ProfileScope() { profileRecord(point, esp_timer_get_time() - start); }
+
+   private:
+    int point;
+    int64_t start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(point) \
+    ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(point)
+#define PROFILE_RECORD(point, durationUs) profileRecord(point, durationUs)
+
+// Log the percentiles when they are due. Call on every network task round.
+void maintainProfiler();
+#else
+#define PROFILE_SCOPE(point) \
+    do {                     \
+    } while (0)
+#define PROFILE_RECORD(point, durationUs) \
+    do {                                  \
+    } while (0)
+
+inline void maintainProfiler() {}
+#endif
+
+#endif  // PROFILER_H
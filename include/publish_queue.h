@@ -0,0 +1,79 @@
+/*
+ * File: publish_queue.h
+ * Description: Store-and-forward queue for the readings that still have to
+ *              be published to the MQTT broker. Readings are kept in RAM
+ *              and overflow to a ring file in flash (LittleFS) while the
+ *              broker is unreachable, then drain in rate-limited batches.
+ *              Only readings with a Unix time go to flash: until SNTP has
+ *              set the clock, those pushed out of RAM are dropped (and
+ *              counted on /metrics), so that no reading restored after a
+ *              reboot is backfilled without its time.
+ */
+
+#ifndef PUBLISH_QUEUE_H
+#define PUBLISH_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+// Number of readings kept in RAM before overflowing to flash
+const size_t PUBLISH_QUEUE_RAM_CAPACITY = 32;
+
+// Number of readings kept in flash. When it is full the oldest are dropped.
+const uint32_t PUBLISH_QUEUE_FLASH_CAPACITY = 4096;
+
+// Draining: one round every DRAIN_INTERVAL_MS, publishing at most
+// DRAIN_BATCH_SIZE separate messages or one batch message
+const size_t DRAIN_BATCH_SIZE = 10;
+const uint32_t DRAIN_INTERVAL_MS = 500;
+
+// Batching: readings sent together in one array message, flushed once
+// PUBLISH_BATCH_SAMPLES readings are queued or every PUBLISH_BATCH_FLUSH_MS.
+// A batch of 1 (the default) publishes every reading on its own. Both can
+// be changed at runtime, see runtime_config.h
+#ifndef PUBLISH_BATCH_SAMPLES
+#define PUBLISH_BATCH_SAMPLES 1
+#endif
+#ifndef PUBLISH_BATCH_FLUSH_MS
+#define PUBLISH_BATCH_FLUSH_MS 30000
+#endif
+
+// Largest batch, at build time or at runtime, e.g. -D MAX_BATCH_SAMPLES=30.
+// The message buffers are sized for it: MAX_PAYLOAD_SIZE bytes per reading
+// (per in-flight message with QoS 1).
+#ifndef MAX_BATCH_SAMPLES
+#define MAX_BATCH_SAMPLES 10
+#endif
+static_assert(PUBLISH_BATCH_SAMPLES >= 1 &&
+                  PUBLISH_BATCH_SAMPLES <= MAX_BATCH_SAMPLES,
+              "PUBLISH_BATCH_SAMPLES must be between 1 and MAX_BATCH_SAMPLES");
+
+// Largest number of readings handed to the publisher in one round
+const size_t MAX_DRAIN_READINGS = MAX_BATCH_SAMPLES > DRAIN_BATCH_SIZE
+                                      ? MAX_BATCH_SAMPLES
+                                      : DRAIN_BATCH_SIZE;
+
+// Function used to publish queued readings, handed over oldest first.
+// `lastIsLive` is true when the last one was taken less than a sampling
+// interval ago, so it goes out as a live reading rather than as backfill. Returns how many readings, from
+// the first one, were published; the others stay in the queue.
+typedef size_t (*ReadingPublisher)(const SensorSnapshot *readings,
+                                   size_t count, bool lastIsLive);
+
+// Mount the file system and restore the readings left in flash
+void setupPublishQueue();
+
+// Add a reading at the back of the queue
+void enqueueReading(const SensorSnapshot &reading);
+
+// Hand up to `maxReadings` of the oldest readings to `publish`, if
+// DRAIN_INTERVAL_MS has elapsed since the last round.
+// Returns the number of readings published.
+size_t drainPublishQueue(ReadingPublisher publish, size_t maxReadings);
+
+// Number of readings waiting to be published
+size_t pendingReadings();
+
+#endif  // PUBLISH_QUEUE_H
@@ -0,0 +1,71 @@
+/*
+ * File: rmt_dht_sensor.h
+ * Description: DHT11/DHT22 driver that captures the sensor's pulse train
+ *              with the ESP32 RMT peripheral instead of bit-banging it with
+ *              interrupts disabled. A transaction runs asynchronously from
+ *              esp_timer callbacks and ends with a completion callback;
+ *              the CPU is free (and interrupts stay enabled) throughout.
+ */
+
+#ifndef RMT_DHT_SENSOR_H
+#define RMT_DHT_SENSOR_H
+
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+
+#include "polled_sensor.h"
+
+class RmtDhtSensor : public PolledSensor {
+   public:
+    // Called once a transaction completes, from the esp_timer task.
+    // `sample` is only meaningful when `status` is SAMPLE_OK.
+    typedef void (*ReadCallback)(void *context, SampleStatus status,
+                                 const Sample &sample);
+
+    // `type` is DHT11 or DHT22; every sensor needs its own RMT channel
+    RmtDhtSensor(uint8_t pin, uint8_t type, rmt_channel_t channel)
+        : pin(pin), type(type), channel(channel) {}
+
+    void begin() override;
+
+    // Start a transaction and return right away. Returns false if one is
+    // already running or the driver could not be set up.
+    bool startRead(ReadCallback callback, void *context);
+
+    // PolledSensor interface. The caller waits on a semaphore (without
+    // spinning) until the transaction completes. Within DHT_MIN_INTERVAL_MS
+    // of the previous one, its result is returned instead.
+    SampleStatus readSample(Sample &sample) override;
+
+   private:
+    static void onStartPulseDone(void *arg);
+    static void onFrameDone(void *arg);
+    static void onBlockingReadDone(void *context, SampleStatus status,
+                                   const Sample &sample);
+
+    SampleStatus decode(const rmt_item32_t *items, size_t count,
+                        Sample &sample) const;
+    void finishRead(SampleStatus status, const Sample &sample);
+
+    uint8_t pin;
+    uint8_t type;
+    rmt_channel_t channel;
+    RingbufHandle_t ringBuffer = nullptr;
+    esp_timer_handle_t startTimer = nullptr;
+    esp_timer_handle_t frameTimer = nullptr;
+    SemaphoreHandle_t readDone = nullptr;
+
+    volatile bool busy = false;
+    ReadCallback callback = nullptr;
+    void *callbackContext = nullptr;
+
+    // Result of the last blocking read
+    SampleStatus lastStatus = SAMPLE_ERROR;
+    Sample lastSample = {NAN, NAN};
+    unsigned long lastReadTime = 0;
+    bool hasRead = false;
+};
+
+#endif  // RMT_DHT_SENSOR_H
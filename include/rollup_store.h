@@ -0,0 +1,54 @@
+/*
+ * File: rollup_store.h
+ * Description: Hourly rollups (min/max/mean/count) of every sensor, kept
+ *              in a ring file on LittleFS next to the history. Each hour
+ *              is written once, when it is over (see rollups.h), so long
+ *              range queries read one record per hour instead of decoding
+ *              every sample.
+ */
+
+#ifndef ROLLUP_STORE_H
+#define ROLLUP_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rollup.h"
+
+// Length of a rollup, in seconds
+const uint32_t ROLLUP_PERIOD_S = 3600;
+
+// Number of records in the ring file, e.g. -D ROLLUP_RECORDS=4096.
+// One record per sensor and hour: the default 44 KB keep six weeks of
+// one sensor.
+#ifndef ROLLUP_RECORDS
+#define ROLLUP_RECORDS 1024
+#endif
+
+// After a restart, the hours missing since the last record are rebuilt
+// from the history, up to this far back. Records are thus never more than
+// this much older than the ones before them.
+const uint32_t ROLLUP_REBUILD_S = 24 * 3600;
+
+// Called for every hour of a range, oldest first.
+// Return false to stop early.
+typedef bool (*RollupVisitor)(const Rollup &rollup, void *context);
+
+// Open the ring file, creating it on the first boot. Call after
+// setupPublishQueue(), which mounts LittleFS.
+void setupRollupStore();
+
+// Append the rollup of an hour that is over
+void storeRollup(uint8_t sensor, const Rollup &rollup);
+
+// Start of the newest hour stored for `sensor`, 0 if none
+uint32_t lastStoredRollup(uint8_t sensor);
+
+// Visit the stored hours of `sensor` starting between `from` and `to`
+// (Unix times, inclusive). The current hour is not stored yet, see
+// currentRollup(). Safe to call from any task. Returns the number of hours
+// visited.
+size_t readRollups(uint8_t sensor, uint32_t from, uint32_t to,
+                   RollupVisitor visitor, void *context);
+
+#endif  // ROLLUP_STORE_H
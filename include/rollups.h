@@ -0,0 +1,66 @@
+/*
+ * File: rollups.h
+ * Description: Rollups (min/max/mean/count) of every sensor by minute, hour
+ *              and day. Each reading updates the bucket of every
+ *              resolution, so nothing ever rescans the readings; when a
+ *              bucket is over it is queued for MQTT on its own topic, e.g.
+ *              "esp32/rollup/1h", and hours are also stored in flash (see
+ *              rollup_store.h).
+ *
+ *              Rollups are computed from the filtered values, like the
+ *              history they are rebuilt from after a restart: the minimum
+ *              and maximum are those of the filter output, not of the raw
+ *              readings, so a short excursion the filter smooths out does
+ *              not show up in them.
+ */
+
+#ifndef ROLLUPS_H
+#define ROLLUPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rollup.h"
+#include "sampling.h"
+
+enum RollupResolution { ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_DAY, ROLLUPS_COUNT };
+
+// Length of the buckets of each resolution, in seconds. Days are in UTC.
+constexpr uint32_t ROLLUP_PERIODS_S[ROLLUPS_COUNT] = {60, 3600, 86400};
+
+// Suffix of the topic of each resolution
+extern const char *ROLLUP_NAMES[ROLLUPS_COUNT];
+
+// Buckets waiting for MQTT. While the broker is unreachable the newest
+// ones are dropped once it is full; hours can still be read back from
+// flash. A power of two, see spsc_queue.h.
+const size_t ROLLUP_QUEUE_SIZE = 32;
+
+// A bucket that is over, as published
+struct ClosedRollup {
+    uint8_t sensor;
+    RollupResolution resolution;
+    Rollup rollup;
+};
+
+// Called for every closed bucket to publish, oldest first.
+// Returns false if it could not be published.
+typedef bool (*RollupPublisher)(const ClosedRollup &closed);
+
+// Add the filtered values of `reading` to the buckets of its sensor,
+// closing those that are over. The first reading of a sensor after boot
+// first rebuilds its buckets from the history and the stored hours.
+// Readings without a Unix time and failed reads (!sensorOk) are skipped.
+// Call from the aggregation task.
+void recordRollups(const SensorSnapshot &reading);
+
+// Copy the bucket in progress of `sensor` at `resolution`. Safe to call
+// from any task. Returns false if it has no readings yet.
+bool currentRollup(uint8_t sensor, RollupResolution resolution,
+                   Rollup &rollup);
+
+// Publish up to `maxRollups` closed buckets, stopping at the first
+// failure. Call from the network task. Returns how many were published.
+size_t drainRollups(RollupPublisher publish, size_t maxRollups);
+
+#endif  // ROLLUPS_H
@@ -0,0 +1,61 @@
+/*
+ * File: runtime_config.h
+ * Description: Settings that can be changed without reflashing: the
+ *              sampling interval, the filter window, the deadband and the
+ *              batching. They are sent as a retained JSON message on a
+ *              per-device MQTT topic, applied live and saved in NVS, so
+ *              they also hold after a reboot without a broker.
+ *
+ *              The hot path never parses anything: runtimeConfig() returns
+ *              a copy of the cached struct, lock-free, from any task.
+ */
+
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include <stdint.h>
+
+#include "deadband.h"
+
+// Limits of the sampling interval: the DHT sensors need about 2 seconds
+// between readings
+const uint32_t MIN_SAMPLE_INTERVAL_MS = 2000;
+const uint32_t MAX_SAMPLE_INTERVAL_MS = 3600000;
+
+struct RuntimeConfig {
+    uint32_t sampleIntervalMs;  // Time between two readings of a sensor
+    uint32_t windowSize;        // Readings of the window filters
+    DeadbandConfig deadband;
+    uint32_t batchSamples;  // Readings per batch message, 1 disables batching
+    uint32_t batchFlushMs;  // Maximum time a partial batch is held back
+};
+
+// Compiled-in values, used until a config is received or loaded from NVS
+RuntimeConfig defaultRuntimeConfig();
+
+// Load the config saved in NVS, if any. Call once at boot, before the
+// sampling task starts.
+void loadRuntimeConfig();
+
+// Latest config. Safe to call from any task.
+RuntimeConfig runtimeConfig();
+
+// Apply a (NUL-terminated) JSON object such as
+//   {"interval_ms":5000,"window":30,"deadband_temperature":0.3,
+//    "deadband_humidity":1,"heartbeat_ms":600000,"batch":10,
+//    "batch_flush_ms":60000}
+// Missing keys keep their current value; out-of-range values are ignored.
+// All the keys but the deadband thresholds take whole numbers; "batch" goes
+// up to MAX_BATCH_SAMPLES (see publish_queue.h).
+// The result is saved in NVS when it changed. Returns false if no valid
+// key was found. Must only be called from one task.
+bool applyRuntimeConfig(const char *json);
+
+// Unique id of this device, from its MAC, e.g. "e5d4c3b2a124"
+const char *deviceId();
+
+// Retained topic holding the config of this device, e.g.
+// "esp32/e5d4c3b2a124/config", where the middle part is its deviceId()
+const char *runtimeConfigTopic();
+
+#endif  // RUNTIME_CONFIG_H
@@ -0,0 +1,83 @@
+/*
+ * File: sampling.h
+ * Description: Interface of the sampling task, the only code that talks to
+ *              the sensors. Everyone else (web server, aggregation and
+ *              network tasks) reads the latest published snapshot of each
+ *              sensor, or the queue of every snapshot.
+ */
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_snapshot.h"
+
+class PolledSensor;
+
+// Largest number of sensors on one board
+const size_t MAX_SENSORS = 8;
+
+// Default time between two readings of the same sensor, in milliseconds.
+// It can be changed at runtime, see runtime_config.h
+const uint32_t SAMPLE_INTERVAL_MS = 3000;
+
+// Size of the moving average, i.e., how many readings to consider.
+// Can be raised from platformio.ini, e.g. -D MOVING_AVERAGE_WINDOW=120.
+// This is also the largest window that can be set at runtime.
+#ifndef MOVING_AVERAGE_WINDOW
+#define MOVING_AVERAGE_WINDOW 10
+#endif
+const size_t MOVING_AVERAGE_SIZE = MOVING_AVERAGE_WINDOW;
+
+// Snapshots waiting for the task set by forwardSamples(): 48 s of readings
+// of one sensor at the default interval. A power of two, see spsc_queue.h.
+const size_t SAMPLE_QUEUE_SIZE = 16;
+
+// Unix times before this one mean the clock was not set by SNTP yet
+const uint32_t MIN_VALID_EPOCH = 1700000000;
+
+// A sensor read by the sampling task
+struct SensorDefinition {
+    const char *name;         // Short name, e.g. "dht0"
+    const char *topicPrefix;  // Prefix of its MQTT topics, e.g. "esp32"
+    PolledSensor *sensor;
+};
+
+// Initialize the sensors and start the sampling task
+void startSamplingTask();
+
+// From now on, also queue every snapshot for `consumer` and notify it
+// (xTaskNotifyGive) after each one. Until then only the latest snapshot
+// of each sensor is kept. Call once.
+void forwardSamples(TaskHandle_t consumer);
+
+// Take the oldest queued snapshot. Call from the consumer task only.
+// Returns false when there is none.
+bool takeSample(SensorSnapshot &snapshot);
+
+// Initialize the sensors without starting the task (low-power mode)
+void beginSensors();
+
+// Take one reading of a sensor, update its filters and fill `snapshot`.
+// Returns false, and `snapshot` must be ignored, while the sensor has not
+// produced a valid reading yet. Used by the sampling task, or directly
+// when there is no task.
+bool takeReading(size_t sensorIndex, SensorSnapshot &snapshot);
+
+// Number of sensors, and details of each one
+size_t sensorCount();
+const SensorDefinition &sensorDefinition(size_t sensorIndex);
+
+// Copy the latest snapshot of a sensor into `snapshot` and return its
+// generation. Returns 0 (and leaves `snapshot` untouched) until the first
+// reading of that sensor is done.
+uint32_t readSnapshot(size_t sensorIndex, SensorSnapshot &snapshot);
+
+// Same as above, for the first sensor (the one shown on the web page)
+uint32_t readSnapshot(SensorSnapshot &snapshot);
+
+#endif  // SAMPLING_H
@@ -0,0 +1,73 @@
+/*
+ * File: task_layout.h
+ * Description: Core, priority and stack size of every task of the
+ *              firmware. Core 0 (the network core) runs the radio, lwIP,
+ *              the web server and MQTT; core 1 (the application core) runs
+ *              the sensors and everything computed from their readings, so
+ *              a burst of HTTP requests never delays a reading. The two
+ *              sides only exchange data through the snapshot buffers and
+ *              lock-free single-producer/single-consumer queues:
+ *
+ *                sampling --samples--> aggregation --reports--> network
+ *                                                  --rollups--> network
+ *
+ *              Core 1                      Core 0
+ *              5 sampling (4 KiB)          3 async_tcp (web server)
+ *              3 aggregation (6 KiB)       2 network (8 KiB)
+ *                                          1 ota (8 KiB), 1 logger (2 KiB)
+ *                                          1 resolver (4 KiB)
+ *
+ *              The ESP-IDF Wi-Fi, lwIP and timer tasks run above all of
+ *              them on core 0. The async_tcp task belongs to AsyncTCP, it
+ *              is pinned by CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini.
+ */
+
+#ifndef TASK_LAYOUT_H
+#define TASK_LAYOUT_H
+
+#include <stdint.h>
+
+const int NETWORK_CORE = 0;
+const int APPLICATION_CORE = 1;
+
+// Reads the sensors. Above everything else on its core, so its cadence
+// only depends on the tick and the length of a sensor transaction.
+const int SAMPLING_TASK_CORE = APPLICATION_CORE;
+const int SAMPLING_TASK_PRIORITY = 5;
+const uint32_t SAMPLING_TASK_STACK_SIZE = 4096;
+
+// Records the samples in the history and the rollups and applies the
+// deadband. Its flash writes run while the sampling task sleeps.
+const int AGGREGATION_TASK_CORE = APPLICATION_CORE;
+const int AGGREGATION_TASK_PRIORITY = 3;
+const uint32_t AGGREGATION_TASK_STACK_SIZE = 6144;
+
+// Wi-Fi, MQTT, OTA checks, the publish queue and the Server-Sent Events.
+// It replaces the Arduino loop(), which ends once setup() is done.
+const int NETWORK_TASK_CORE = NETWORK_CORE;
+const int NETWORK_TASK_PRIORITY = 2;
+const uint32_t NETWORK_TASK_STACK_SIZE = 8192;
+
+// Longest sleep of the network task between two rounds. A reading queued
+// for it wakes it up earlier.
+const uint32_t NETWORK_TASK_PERIOD_MS = 10;
+
+// Pulls firmware images, below the network task so MQTT stays alive
+// during the download
+const int OTA_TASK_CORE = NETWORK_CORE;
+const int OTA_TASK_PRIORITY = 1;
+const uint32_t OTA_TASK_STACK_SIZE = 8192;
+
+// Looks up the name of the MQTT broker (DNS or mDNS), which blocks for
+// up to a few seconds, while the network task carries on. Started for
+// each lookup and ended after it.
+const int RESOLVER_TASK_CORE = NETWORK_CORE;
+const int RESOLVER_TASK_PRIORITY = 1;
+const uint32_t RESOLVER_TASK_STACK_SIZE = 4096;
+
+// Writes the buffered log messages to Serial
+const int LOGGER_TASK_CORE = NETWORK_CORE;
+const int LOGGER_TASK_PRIORITY = 1;
+const uint32_t LOGGER_TASK_STACK_SIZE = 2048;
+
+#endif  // TASK_LAYOUT_H
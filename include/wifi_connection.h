@@ -0,0 +1,50 @@
+/*
+ * File: wifi_connection.h
+ * Description: Wi-Fi connection with a fast path on boot: the BSSID, channel
+ *              and IP configuration of the last good connection are cached
+ *              in NVS and reused, skipping the scan and DHCP. A full scan
+ *              with DHCP is only done when the fast path fails.
+ *              After boot, maintainWifi() restores a lost link with backoff
+ *              and tells the listeners when the link goes up or down.
+ */
+
+#ifndef WIFI_CONNECTION_H
+#define WIFI_CONNECTION_H
+
+#include <stdint.h>
+
+// How long the fast path may take before falling back to a full scan
+const uint32_t WIFI_FAST_CONNECT_TIMEOUT_MS = 3000;
+
+// Delay between attempts to restore a lost link: starts at 2 seconds and
+// doubles after every failure, up to 1 minute
+const uint32_t WIFI_RETRY_BASE_MS = 2000;
+const uint32_t WIFI_RETRY_MAX_MS = 60000;
+
+// Function called when the link goes up (`connected` true) or down
+typedef void (*WifiListener)(bool connected);
+
+// Maximum number of listeners
+const int MAX_WIFI_LISTENERS = 4;
+
+// Start connecting to `ssid`. Returns immediately; the connection is driven
+// by Wi-Fi events.
+void beginWifi(const char *ssid, const char *password);
+
+// Wait until connected (and an IP address is available), for at most
+// `timeoutMs`. Falls back from the fast path to a full scan if needed.
+// Returns true once connected.
+bool waitForWifi(uint32_t timeoutMs);
+
+// Whether the station is connected and has an IP address
+bool wifiConnected();
+
+// Register a function called, from maintainWifi(), when the link changes
+void onWifiChange(WifiListener listener);
+
+// Watch the link and restore it when lost. Call on every network task round;
+// it never blocks. The driver's own auto-reconnect is turned off, so that
+// attempts follow the backoff instead of retrying in a tight loop.
+void maintainWifi();
+
+#endif  // WIFI_CONNECTION_H
@@ -0,0 +1,49 @@
+/*
+ * File: backoff.h
+ * Description: Exponential backoff with jitter, used to space out reconnection
+ *              attempts so that many nodes do not retry in lockstep after
+ *              a broker or access point restart.
+ */
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+class Backoff {
+   public:
+    Backoff(uint32_t baseDelayMs, uint32_t maxDelayMs)
+        : baseDelayMs(baseDelayMs), maxDelayMs(maxDelayMs) {}
+
+    // Delay to wait before the next attempt. The upper bound doubles after
+    // every failure (up to maxDelayMs) and the actual delay is picked in
+    // [bound / 2, bound] using `randomValue` (e.g. esp_random()).
+    uint32_t nextDelay(uint32_t randomValue) {
+        // Double the bound while it is below the maximum, which also
+        // keeps the shift from overflowing
+        uint32_t bound = baseDelayMs;
+        for (uint32_t i = 0; i < attempt && bound < maxDelayMs; i++) {
+            bound *= 2;
+        }
+        if (bound > maxDelayMs) {
+            bound = maxDelayMs;
+        }
+        attempt++;
+
+        uint32_t half = bound / 2;
+        return half + randomValue % (bound - half + 1);
+    }
+
+    // Call after a successful attempt
+    void reset() { attempt = 0; }
+
+    // Number of failed attempts since the last reset
+    uint32_t attempts() const { return attempt; }
+
+   private:
+    uint32_t baseDelayMs;
+    uint32_t maxDelayMs;
+    uint32_t attempt = 0;
+};
+
+#endif  // BACKOFF_H
@@ -0,0 +1,88 @@
+/*
+ * File: bit_stream.h
+ * Description: Bit-level writer and reader over a caller-provided byte
+ *              buffer, used by the compressed history pages. Bits are
+ *              stored from the most significant bit of each byte.
+ */
+
+#ifndef BIT_STREAM_H
+#define BIT_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class BitWriter {
+   public:
+    // `position` is the number of bits already in the buffer, to resume
+    // appending to a partly filled one
+    BitWriter(uint8_t *buffer, size_t size, size_t position = 0)
+        : buffer(buffer), capacity(size * 8), position(position) {}
+
+    // Append the `bits` low bits of `value` (up to 32), most significant
+    // first. Returns false, writing nothing, if they do not fit.
+    bool write(uint32_t value, uint8_t bits) {
+        if (bits > remaining()) {
+            return false;
+        }
+        for (int i = bits - 1; i >= 0; i--) {
+            uint8_t mask = 0x80 >> (position % 8);
+            if ((value >> i) & 1) {
+                buffer[position / 8] |= mask;
+            } else {
+                buffer[position / 8] &= ~mask;
+            }
+            position++;
+        }
+        return true;
+    }
+
+    size_t bitsWritten() const { return position; }
+    size_t remaining() const { return capacity - position; }
+
+   private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t position;
+};
+
+class BitReader {
+   public:
+    // `bits` is the number of valid bits in the buffer
+    BitReader(const uint8_t *buffer, size_t bits)
+        : buffer(buffer), capacity(bits) {}
+
+    // Read `bits` bits (up to 32) as an unsigned value. Past the end, the
+    // missing bits read as zeros and overflowed() becomes true.
+    uint32_t read(uint8_t bits) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < bits; i++) {
+            value <<= 1;
+            if (position < capacity) {
+                value |= (buffer[position / 8] >> (7 - position % 8)) & 1;
+                position++;
+            } else {
+                overflow = true;
+            }
+        }
+        return value;
+    }
+
+    // Read `bits` bits as a two's complement signed value
+    int32_t readSigned(uint8_t bits) {
+        uint32_t value = read(bits);
+        if (bits < 32 && (value & (1u << (bits - 1)))) {
+            value |= ~0u << bits;
+        }
+        return static_cast<int32_t>(value);
+    }
+
+    bool overflowed() const { return overflow; }
+
+   private:
+    const uint8_t *buffer;
+    size_t capacity;
+    size_t position = 0;
+    bool overflow = false;
+};
+
+#endif  // BIT_STREAM_H
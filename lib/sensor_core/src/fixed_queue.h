@@ -0,0 +1,57 @@
+/*
+ * File: fixed_queue.h
+ * Description: Statically sized FIFO queue. All the storage is reserved at
+ *              compile time, so pushing and popping never touch the heap.
+ */
+
+#ifndef FIXED_QUEUE_H
+#define FIXED_QUEUE_H
+
+#include <stddef.h>
+
+template <typename T, size_t N>
+class FixedQueue {
+    static_assert(N > 0, "FixedQueue needs room for at least one element");
+
+   public:
+    // Add an element at the back. Returns false if the queue is full.
+    bool push(const T &value) {
+        if (count == N) {
+            return false;
+        }
+        items[(head + count) % N] = value;
+        count++;
+        return true;
+    }
+
+    // Oldest element. Must not be called on an empty queue.
+    const T &front() const { return items[head]; }
+
+    // i-th element, from the oldest (0) to the newest (size() - 1)
+    const T &operator[](size_t i) const { return items[(head + i) % N]; }
+
+    // Remove the oldest element. Does nothing on an empty queue.
+    void pop() {
+        if (count > 0) {
+            head = (head + 1) % N;
+            count--;
+        }
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    static constexpr size_t capacity() { return N; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == N; }
+
+   private:
+    T items[N] = {};
+    size_t head = 0;  // Index of the oldest element
+    size_t count = 0;
+};
+
+#endif  // FIXED_QUEUE_H
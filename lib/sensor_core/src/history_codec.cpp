@@ -0,0 +1,101 @@
+/*
+ * File: history_codec.cpp
+ * Description: Encoder and decoder of the compressed history samples.
+ */
+
+#include "history_codec.h"
+
+void writeTimeDelta(BitWriter &bits, int32_t deltaOfDelta) {
+    if (deltaOfDelta == 0) {
+        bits.write(0, 1);
+    } else if (deltaOfDelta >= -64 && deltaOfDelta <= 63) {
+        bits.write(0x2, 2);
+        bits.write(deltaOfDelta, 7);
+    } else if (deltaOfDelta >= -2048 && deltaOfDelta <= 2047) {
+        bits.write(0x6, 3);
+        bits.write(deltaOfDelta, 12);
+    } else if (deltaOfDelta >= -524288 && deltaOfDelta <= 524287) {
+        bits.write(0xE, 4);
+        bits.write(deltaOfDelta, 20);
+    } else {
+        bits.write(0xF, 4);
+        bits.write(deltaOfDelta, 32);
+    }
+}
+
+void writeValue(BitWriter &bits, int16_t value, int16_t last) {
+    int32_t delta = value - last;
+    if (delta == 0) {
+        bits.write(0, 1);
+    } else if (delta >= -8 && delta <= 7) {
+        bits.write(0x2, 2);
+        bits.write(delta, 4);
+    } else if (delta >= -128 && delta <= 127) {
+        bits.write(0x6, 3);
+        bits.write(delta, 8);
+    } else {
+        bits.write(0x7, 3);
+        bits.write(static_cast<uint16_t>(value), 16);
+    }
+}
+
+bool encodeHistorySample(BitWriter &bits, HistoryCursor &cursor,
+                         uint32_t epoch, int16_t temperature,
+                         int16_t humidity) {
+    if (bits.remaining() < HISTORY_MAX_SAMPLE_BITS) {
+        return false;
+    }
+
+    // Modulo 2^32, like the Unix times: any jump of the clock, forward or
+    // back, decodes to the same epoch without overflowing
+    int32_t delta = static_cast<int32_t>(epoch - cursor.epoch);
+    writeTimeDelta(bits, static_cast<int32_t>(static_cast<uint32_t>(delta) -
+                                              cursor.delta));
+    writeValue(bits, temperature, cursor.temperature);
+    writeValue(bits, humidity, cursor.humidity);
+    cursor = {epoch, delta, temperature, humidity};
+    return true;
+}
+
+int32_t readTimeDelta(BitReader &bits) {
+    if (bits.read(1) == 0) {
+        return 0;
+    }
+    if (bits.read(1) == 0) {
+        return bits.readSigned(7);
+    }
+    if (bits.read(1) == 0) {
+        return bits.readSigned(12);
+    }
+    if (bits.read(1) == 0) {
+        return bits.readSigned(20);
+    }
+    return bits.readSigned(32);
+}
+
+int16_t readValue(BitReader &bits, int16_t last) {
+    if (bits.read(1) == 0) {
+        return last;
+    }
+    if (bits.read(1) == 0) {
+        return last + bits.readSigned(4);
+    }
+    if (bits.read(1) == 0) {
+        return last + bits.readSigned(8);
+    }
+    return static_cast<int16_t>(bits.read(16));
+}
+
+bool decodeHistorySample(BitReader &bits, HistoryCursor &cursor) {
+    HistoryCursor next;
+    next.delta = static_cast<int32_t>(static_cast<uint32_t>(cursor.delta) +
+                                      readTimeDelta(bits));
+    next.epoch = cursor.epoch + next.delta;
+    next.temperature = readValue(bits, cursor.temperature);
+    next.humidity = readValue(bits, cursor.humidity);
+    if (bits.overflowed()) {
+        return false;
+    }
+    cursor = next;
+    return true;
+}
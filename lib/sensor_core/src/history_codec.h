@@ -0,0 +1,56 @@
+/*
+ * File: history_codec.h
+ * Description: Gorilla-style compression of the history samples. Each
+ *              sample is bit-packed relative to the previous one:
+ *
+ *   time, delta-of-delta in seconds:  '0'                 same interval
+ *                                     '10'   + 7 bits     -64..63
+ *                                     '110'  + 12 bits    -2048..2047
+ *                                     '1110' + 20 bits
+ *                                     '1111' + 32 bits
+ *   each value, delta in tenths:      '0'                 unchanged
+ *                                     '10'  + 4 bits      -8..7
+ *                                     '110' + 8 bits      -128..127
+ *                                     '111' + 16 bits     absolute value
+ *
+ *              A steady reading thus costs 3 bits.
+ */
+
+#ifndef HISTORY_CODEC_H
+#define HISTORY_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bit_stream.h"
+
+// Layout of the pages of the history store: a header holding the first
+// sample in full, then the encoded samples after it
+const size_t HISTORY_PAGE_SIZE = 512;
+const size_t HISTORY_PAGE_HEADER_SIZE = 24;
+const size_t HISTORY_PAGE_DATA_SIZE =
+    HISTORY_PAGE_SIZE - HISTORY_PAGE_HEADER_SIZE;
+
+// Largest encoding of one sample
+const size_t HISTORY_MAX_SAMPLE_BITS = (4 + 32) + 2 * (3 + 16);
+
+// Last sample encoded or decoded, which the next one is relative to.
+// Start a stream with the first sample and a delta of 0.
+struct HistoryCursor {
+    uint32_t epoch;       // Unix time
+    int32_t delta;        // Seconds since the sample before
+    int16_t temperature;  // In tenths
+    int16_t humidity;     // In tenths
+};
+
+// Append a sample and move `cursor` to it. Returns false, writing
+// nothing, if fewer than HISTORY_MAX_SAMPLE_BITS bits are left.
+bool encodeHistorySample(BitWriter &bits, HistoryCursor &cursor,
+                         uint32_t epoch, int16_t temperature,
+                         int16_t humidity);
+
+// Move `cursor` to the next sample. Returns false if the stream ended
+// before it.
+bool decodeHistorySample(BitReader &bits, HistoryCursor &cursor);
+
+#endif  // HISTORY_CODEC_H
@@ -0,0 +1,90 @@
+/*
+ * File: latency_histogram.h
+ * Description: Fixed-size histogram of durations from which percentiles
+ *              can be read. Buckets are exact below 16 us, then four per
+ *              power of two, so a percentile is within 12.5 % of the true
+ *              value over the whole range. Recording takes a few relaxed
+ *              atomic operations, from any task, and never allocates.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+class LatencyHistogram {
+   public:
+    static constexpr size_t BUCKETS = 16 + 28 * 4;
+
+    void record(uint32_t valueUs) {
+        buckets[bucketOf(valueUs)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        uint32_t seen = maximum.load(std::memory_order_relaxed);
+        while (valueUs > seen &&
+               !maximum.compare_exchange_weak(seen, valueUs,
+                                              std::memory_order_relaxed)) {
+        }
+    }
+
+    // Duration below which `fraction` (0..1] of the recorded ones fall,
+    // e.g. 0.99 for the 99th percentile. Returns 0 when empty.
+    uint32_t percentile(float fraction) const {
+        uint32_t recorded = count();
+        if (recorded == 0) {
+            return 0;
+        }
+        uint32_t rank = fraction * recorded;
+        if (rank < fraction * recorded || rank == 0) {
+            rank++;  // Round up, and at least the first one
+        }
+
+        uint32_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint32_t middle = middleOf(i);
+                return middle < max() ? middle : max();
+            }
+        }
+        return max();
+    }
+
+    uint32_t count() const { return total.load(std::memory_order_relaxed); }
+    uint32_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+    // Forget every duration, e.g. to report on fixed intervals
+    void reset() {
+        for (std::atomic<uint32_t> &bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        maximum.store(0, std::memory_order_relaxed);
+    }
+
+    static size_t bucketOf(uint32_t valueUs) {
+        if (valueUs < 16) {
+            return valueUs;
+        }
+        int msb = 31 - __builtin_clz(valueUs);  // 4..31
+        return 16 + (msb - 4) * 4 + ((valueUs >> (msb - 2)) & 3);
+    }
+
+    // Middle of the durations counted by bucket `i`
+    static uint32_t middleOf(size_t i) {
+        if (i < 16) {
+            return i;
+        }
+        int msb = (i - 16) / 4 + 4;
+        uint32_t width = 1u << (msb - 2);
+        return (1u << msb) + (i - 16) % 4 * width + width / 2;
+    }
+
+   private:
+    std::atomic<uint32_t> buckets[BUCKETS] = {};
+    std::atomic<uint32_t> total{0};
+    std::atomic<uint32_t> maximum{0};
+};
+
+#endif  // LATENCY_HISTOGRAM_H
@@ -0,0 +1,328 @@
+/*
+ * File: payload.cpp
+ * Description: JSON and CBOR encoders for the combined MQTT payload.
+ *              They write into a caller-provided buffer and never allocate.
+ */
+
+#include "payload.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t encodeReadingJson(const SensorSnapshot &reading, char *buffer,
+                         size_t size) {
+    int length = snprintf(
+        buffer, size,
+        "{\"s\":%u,\"seq\":%u,\"ts\":%u,\"t\":%.2f,\"h\":%.2f,\"rt\":%.1f,"
+        "\"rh\":%.1f}",
+        (unsigned)reading.sensor, (unsigned)reading.sampleCount,
+        (unsigned)reading.epoch,
+        reading.avgTemperature, reading.avgHumidity, reading.rawTemperature,
+        reading.rawHumidity);
+    if (length < 0 || (size_t)length >= size) {
+        return 0;
+    }
+    return length;
+}
+
+size_t encodeReadingDetailsJson(const SensorSnapshot &reading, uint32_t ageMs,
+                                char *buffer, size_t size) {
+    int length = snprintf(
+        buffer, size,
+        "{\"sensor_index\":%u,\"seq\":%u,\"timestamp\":%u,\"age_ms\":%u,"
+        "\"temperature\":{\"average\":%.2f,\"raw\":%.1f},"
+        "\"humidity\":{\"average\":%.2f,\"raw\":%.1f},"
+        "\"sensor\":{\"ok\":%s,\"failed_readings\":%u}}",
+        (unsigned)reading.sensor, (unsigned)reading.sampleCount,
+        (unsigned)reading.epoch, (unsigned)ageMs, reading.avgTemperature,
+        reading.rawTemperature, reading.avgHumidity, reading.rawHumidity,
+        reading.sensorOk ? "true" : "false", (unsigned)reading.failedReadings);
+    if (length < 0 || (size_t)length >= size) {
+        return 0;
+    }
+    return length;
+}
+
+// Minimal CBOR writer over a fixed buffer. Once the buffer overflows,
+// every further write is ignored and length() returns 0.
+class CborWriter {
+   public:
+    CborWriter(uint8_t *buffer, size_t size) : buffer(buffer), size(size) {}
+
+    // Major type and argument, using the shortest encoding
+    void writeHead(uint8_t majorType, uint32_t argument) {
+        uint8_t type = majorType << 5;
+        if (argument < 24) {
+            writeByte(type | argument);
+        } else if (argument <= 0xFF) {
+            writeByte(type | 24);
+            writeByte(argument);
+        } else if (argument <= 0xFFFF) {
+            writeByte(type | 25);
+            writeBigEndian(argument, 2);
+        } else {
+            writeByte(type | 26);
+            writeBigEndian(argument, 4);
+        }
+    }
+
+    void writeArray(uint32_t items) { writeHead(4, items); }
+
+    void writeMap(uint32_t pairs) { writeHead(5, pairs); }
+
+    void writeUnsigned(uint32_t value) { writeHead(0, value); }
+
+    void writeText(const char *text) {
+        size_t textLength = strlen(text);
+        writeHead(3, textLength);
+        for (size_t i = 0; i < textLength; i++) {
+            writeByte(text[i]);
+        }
+    }
+
+    void writeFloat(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeByte(0xFA);  // Major type 7, single-precision float
+        writeBigEndian(bits, 4);
+    }
+
+    size_t length() const { return overflow ? 0 : position; }
+
+   private:
+    void writeByte(uint8_t value) {
+        if (position < size) {
+            buffer[position++] = value;
+        } else {
+            overflow = true;
+        }
+    }
+
+    void writeBigEndian(uint32_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            writeByte(value >> (8 * i));
+        }
+    }
+
+    uint8_t *buffer;
+    size_t size;
+    size_t position = 0;
+    bool overflow = false;
+};
+
+// Write one reading as a CBOR map
+void writeReadingCbor(CborWriter &writer, const SensorSnapshot &reading) {
+    writer.writeMap(7);
+    writer.writeText("s");
+    writer.writeUnsigned(reading.sensor);
+    writer.writeText("seq");
+    writer.writeUnsigned(reading.sampleCount);
+    writer.writeText("ts");
+    writer.writeUnsigned(reading.epoch);
+    writer.writeText("t");
+    writer.writeFloat(reading.avgTemperature);
+    writer.writeText("h");
+    writer.writeFloat(reading.avgHumidity);
+    writer.writeText("rt");
+    writer.writeFloat(reading.rawTemperature);
+    writer.writeText("rh");
+    writer.writeFloat(reading.rawHumidity);
+}
+
+size_t encodeReadingCbor(const SensorSnapshot &reading, uint8_t *buffer,
+                         size_t size) {
+    CborWriter writer(buffer, size);
+    writeReadingCbor(writer, reading);
+    return writer.length();
+}
+
+size_t encodeReadingsJson(const SensorSnapshot *readings, size_t count,
+                          char *buffer, size_t size) {
+    if (size < 2) {
+        return 0;
+    }
+
+    size_t length = 0;
+    buffer[length++] = '[';
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            buffer[length++] = ',';
+        }
+        // Keep room for the closing bracket
+        size_t written = encodeReadingJson(readings[i], buffer + length,
+                                           size - length - 1);
+        if (written == 0) {
+            return 0;
+        }
+        length += written;
+    }
+    buffer[length++] = ']';
+
+    // Null-terminate when there is room, like a single JSON object
+    if (length < size) {
+        buffer[length] = '\0';
+    }
+    return length;
+}
+
+size_t encodeReadingsCbor(const SensorSnapshot *readings, size_t count,
+                          uint8_t *buffer, size_t size) {
+    CborWriter writer(buffer, size);
+    writer.writeArray(count);
+    for (size_t i = 0; i < count; i++) {
+        writeReadingCbor(writer, readings[i]);
+    }
+    return writer.length();
+}
+
+size_t encodeReading(const SensorSnapshot &reading, uint8_t *buffer,
+                     size_t size) {
+#if PAYLOAD_FORMAT == PAYLOAD_CBOR
+    return encodeReadingCbor(reading, buffer, size);
+#else
+    return encodeReadingJson(reading, reinterpret_cast<char *>(buffer), size);
+#endif
+}
+
+size_t encodeReadings(const SensorSnapshot *readings, size_t count,
+                      uint8_t *buffer, size_t size) {
+#if PAYLOAD_FORMAT == PAYLOAD_CBOR
+    return encodeReadingsCbor(readings, count, buffer, size);
+#else
+    return encodeReadingsJson(readings, count, reinterpret_cast<char *>(buffer),
+                              size);
+#endif
+}
+
+size_t encodeRollupJson(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                        char *buffer, size_t size) {
+    int length = snprintf(
+        buffer, size,
+        "{\"s\":%u,\"ts\":%u,\"p\":%u,\"n\":%u,\"tmin\":%.1f,\"tavg\":%.2f,"
+        "\"tmax\":%.1f,\"hmin\":%.1f,\"havg\":%.2f,\"hmax\":%.1f}",
+        (unsigned)sensor, (unsigned)rollup.start, (unsigned)periodS,
+        (unsigned)rollup.count, rollup.minTemperature,
+        rollup.meanTemperature(), rollup.maxTemperature, rollup.minHumidity,
+        rollup.meanHumidity(), rollup.maxHumidity);
+    if (length < 0 || (size_t)length >= size) {
+        return 0;
+    }
+    return length;
+}
+
+size_t encodeRollupCbor(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                        uint8_t *buffer, size_t size) {
+    CborWriter writer(buffer, size);
+    writer.writeMap(10);
+    writer.writeText("s");
+    writer.writeUnsigned(sensor);
+    writer.writeText("ts");
+    writer.writeUnsigned(rollup.start);
+    writer.writeText("p");
+    writer.writeUnsigned(periodS);
+    writer.writeText("n");
+    writer.writeUnsigned(rollup.count);
+    writer.writeText("tmin");
+    writer.writeFloat(rollup.minTemperature);
+    writer.writeText("tavg");
+    writer.writeFloat(rollup.meanTemperature());
+    writer.writeText("tmax");
+    writer.writeFloat(rollup.maxTemperature);
+    writer.writeText("hmin");
+    writer.writeFloat(rollup.minHumidity);
+    writer.writeText("havg");
+    writer.writeFloat(rollup.meanHumidity());
+    writer.writeText("hmax");
+    writer.writeFloat(rollup.maxHumidity);
+    return writer.length();
+}
+
+size_t encodeRollup(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                    uint8_t *buffer, size_t size) {
+#if PAYLOAD_FORMAT == PAYLOAD_CBOR
+    return encodeRollupCbor(sensor, periodS, rollup, buffer, size);
+#else
+    return encodeRollupJson(sensor, periodS, rollup,
+                            reinterpret_cast<char *>(buffer), size);
+#endif
+}
+
+const char *skipJsonWhitespace(const char *cursor) {
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' ||
+           *cursor == '\r') {
+        cursor++;
+    }
+    return cursor;
+}
+
+// Find `key` in a flat JSON object and return a pointer to its value,
+// past the colon and any whitespace, or nullptr if it is missing.
+// A quoted occurrence only counts as the key when a colon follows it, so
+// a string value equal to `key` is skipped.
+const char *findJsonValue(const char *json, const char *key) {
+    size_t keyLength = strlen(key);
+    for (const char *p = strchr(json, '"'); p != nullptr;
+         p = strchr(p + 1, '"')) {
+        if (strncmp(p + 1, key, keyLength) != 0 || p[keyLength + 1] != '"') {
+            continue;
+        }
+
+        const char *cursor = skipJsonWhitespace(p + keyLength + 2);
+        if (*cursor != ':') {
+            // Step over the closing quote, it does not open a string
+            p += keyLength + 1;
+            continue;
+        }
+        return skipJsonWhitespace(cursor + 1);
+    }
+    return nullptr;
+}
+
+bool findJsonNumber(const char *json, const char *key, float &value) {
+    const char *cursor = findJsonValue(json, key);
+    if (cursor == nullptr) {
+        return false;
+    }
+    char *end;
+    float number = strtof(cursor, &end);
+    if (end == cursor) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+bool findJsonUnsigned(const char *json, const char *key, uint32_t &value) {
+    const char *cursor = findJsonValue(json, key);
+    // strtoul() would take a sign, and wrap negative numbers around
+    if (cursor == nullptr || *cursor < '0' || *cursor > '9') {
+        return false;
+    }
+    errno = 0;
+    char *end;
+    unsigned long long number = strtoull(cursor, &end, 10);
+    if (errno == ERANGE || number > UINT32_MAX || *end == '.' ||
+        *end == 'e' || *end == 'E') {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+bool findJsonString(const char *json, const char *key, char *value,
+                    size_t size) {
+    const char *cursor = findJsonValue(json, key);
+    if (cursor == nullptr || *cursor != '"') {
+        return false;
+    }
+    const char *start = cursor + 1;
+    const char *end = strchr(start, '"');
+    if (end == nullptr || (size_t)(end - start) >= size) {
+        return false;
+    }
+    memcpy(value, start, end - start);
+    value[end - start] = '\0';
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+ * File: payload.h
+ * Description: Encoders for the combined MQTT payload, which carries the
+ *              moving averages, the raw readings, the timestamp and the
+ *              sequence number of one reading in a single message.
+ */
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rollup.h"
+#include "sensor_snapshot.h"
+
+// Available payload formats
+#define PAYLOAD_LEGACY 0  // One plain-text message per metric and topic
+#define PAYLOAD_JSON 1    // One JSON object per reading
+#define PAYLOAD_CBOR 2    // One CBOR map per reading (RFC 8949)
+
+// Format used by the firmware, e.g. -D PAYLOAD_FORMAT=PAYLOAD_CBOR
+#ifndef PAYLOAD_FORMAT
+#define PAYLOAD_FORMAT PAYLOAD_JSON
+#endif
+
+// Large enough for one reading in any format. An array of N readings
+// fits in N * MAX_PAYLOAD_SIZE bytes.
+const size_t MAX_PAYLOAD_SIZE = 128;
+
+// Encode `reading` as a JSON object, e.g.
+// {"s":0,"seq":42,"ts":1700000000,"t":21.50,"h":40.20,"rt":22.0,"rh":40.0}
+// where "s" is the index of the sensor
+// Returns the payload length, or 0 if `size` is too small.
+size_t encodeReadingJson(const SensorSnapshot &reading, char *buffer,
+                         size_t size);
+
+// Encode `reading` as the self-describing JSON object served by
+// /api/readings, including the sensor health. `ageMs` is how long ago the
+// reading was taken. Returns the length, or 0 if `size` is too small.
+size_t encodeReadingDetailsJson(const SensorSnapshot &reading, uint32_t ageMs,
+                                char *buffer, size_t size);
+
+// Encode `reading` as a CBOR map with the same keys as the JSON object.
+// Floats are sent as single precision. Returns the payload length, or 0 if
+// `size` is too small.
+size_t encodeReadingCbor(const SensorSnapshot &reading, uint8_t *buffer,
+                         size_t size);
+
+// Encode several readings as a JSON array of the objects above.
+// Returns the payload length, or 0 if `size` is too small.
+size_t encodeReadingsJson(const SensorSnapshot *readings, size_t count,
+                          char *buffer, size_t size);
+
+// Encode several readings as a CBOR array of the maps above.
+// Returns the payload length, or 0 if `size` is too small.
+size_t encodeReadingsCbor(const SensorSnapshot *readings, size_t count,
+                          uint8_t *buffer, size_t size);
+
+// Encode `reading` in the format selected by PAYLOAD_FORMAT (JSON for
+// PAYLOAD_LEGACY, which only uses it for backfilled readings)
+size_t encodeReading(const SensorSnapshot &reading, uint8_t *buffer,
+                     size_t size);
+
+// Encode several readings as an array, in the format selected by
+// PAYLOAD_FORMAT (JSON for PAYLOAD_LEGACY)
+size_t encodeReadings(const SensorSnapshot *readings, size_t count,
+                      uint8_t *buffer, size_t size);
+
+// Encode the rollup of `sensor` over `periodS` seconds as a JSON object,
+// e.g. {"s":0,"ts":1700000000,"p":3600,"n":1200,"tmin":21.0,"tavg":21.53,
+// "tmax":22.1,"hmin":40.0,"havg":41.25,"hmax":43.0} where "ts" is the start
+// of the bucket and "n" its number of readings. It fits in MAX_PAYLOAD_SIZE.
+// Returns the payload length, or 0 if `size` is too small.
+size_t encodeRollupJson(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                        char *buffer, size_t size);
+
+// Encode a rollup as a CBOR map with the same keys as the JSON object.
+// Returns the payload length, or 0 if `size` is too small.
+size_t encodeRollupCbor(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                        uint8_t *buffer, size_t size);
+
+// Encode a rollup in the format selected by PAYLOAD_FORMAT (JSON for
+// PAYLOAD_LEGACY)
+size_t encodeRollup(uint8_t sensor, uint32_t periodS, const Rollup &rollup,
+                    uint8_t *buffer, size_t size);
+
+// Find the number stored under `key` in a flat, NUL-terminated JSON object,
+// e.g. 0.5 for "humidity" in {"humidity":0.5}. Used to read the MQTT config.
+// Returns false if the key is missing or its value is not a number.
+bool findJsonNumber(const char *json, const char *key, float &value);
+
+// Same as above for a whole number, e.g. 30 for "window" in {"window":30}.
+// Returns false if the value is missing, negative, has a fraction or an
+// exponent, or does not fit in 32 bits.
+bool findJsonUnsigned(const char *json, const char *key, uint32_t &value);
+
+// Copy the string stored under `key` in a flat, NUL-terminated JSON object
+// into `value`. Escape sequences are not supported. Returns false if the
+// key is missing, its value is not a string or does not fit in `size`.
+bool findJsonString(const char *json, const char *key, char *value,
+                    size_t size);
+
+#endif  // PAYLOAD_H
@@ -0,0 +1,132 @@
+/*
+ * File: ring_window.h
+ * Description: Fixed-capacity ring buffer that keeps the last N readings
+ *              together with a running sum and sum of squares, so the mean
+ *              and the variance of the window are available in O(1) and
+ *              nothing is allocated after boot. The window can be shortened
+ *              at runtime, down to a single reading.
+ */
+
+#ifndef RING_WINDOW_H
+#define RING_WINDOW_H
+
+#include <stddef.h>
+
+template <typename T, size_t N>
+class RingWindow {
+    static_assert(N > 0, "RingWindow needs room for at least one reading");
+
+   public:
+    // Add a reading, dropping the oldest one when the window is full
+    void push(T value) {
+        if (count == limit) {
+            T oldest = readings[head];
+            sum -= oldest;
+            sumOfSquares -= oldest * oldest;
+        } else {
+            count++;
+        }
+
+        readings[head] = value;
+        sum += value;
+        sumOfSquares += value * value;
+        head = (head + 1) % limit;
+
+        // Adding and subtracting floats slowly accumulates rounding errors,
+        // so rebuild the sums from the stored readings once per wrap around.
+        // This keeps the cost amortized O(1).
+        if (++pushesSinceResync == limit) {
+            resync();
+        }
+    }
+
+    // Forget all readings
+    void clear() {
+        head = 0;
+        count = 0;
+        pushesSinceResync = 0;
+        sum = T();
+        sumOfSquares = T();
+    }
+
+    // Keep at most `newLength` readings from now on (clamped to 1..N),
+    // dropping the oldest ones if there are more. O(N), meant for
+    // configuration changes rather than the hot path.
+    void resize(size_t newLength) {
+        if (newLength < 1) {
+            newLength = 1;
+        } else if (newLength > N) {
+            newLength = N;
+        }
+
+        // Move the readings to keep to the start of the buffer, in order
+        size_t keep = count < newLength ? count : newLength;
+        T kept[N];
+        for (size_t i = 0; i < keep; i++) {
+            kept[i] = (*this)[count - keep + i];
+        }
+        for (size_t i = 0; i < keep; i++) {
+            readings[i] = kept[i];
+        }
+
+        limit = newLength;
+        count = keep;
+        head = keep % limit;
+        resync();
+    }
+
+    size_t size() const { return count; }
+    static constexpr size_t capacity() { return N; }
+    // Current maximum number of readings, N unless resized
+    size_t length() const { return limit; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == limit; }
+
+    // Most recent reading. Returns T() when the window is empty.
+    T back() const {
+        return count == 0 ? T() : readings[(head + limit - 1) % limit];
+    }
+
+    // i-th reading, from the oldest (0) to the most recent (size() - 1)
+    T operator[](size_t i) const {
+        return readings[(head + limit - count + i) % limit];
+    }
+
+    T total() const { return sum; }
+
+    // Arithmetic mean of the window. Returns T() when the window is empty.
+    T mean() const { return count == 0 ? T() : sum / count; }
+
+    // Population variance of the window. Returns T() when it is empty.
+    T variance() const {
+        if (count == 0) {
+            return T();
+        }
+        T average = sum / count;
+        T result = sumOfSquares / count - average * average;
+        // Guard against tiny negative values caused by rounding
+        return result < T() ? T() : result;
+    }
+
+   private:
+    void resync() {
+        sum = T();
+        sumOfSquares = T();
+        for (size_t i = 0; i < count; i++) {
+            T value = (*this)[i];
+            sum += value;
+            sumOfSquares += value * value;
+        }
+        pushesSinceResync = 0;
+    }
+
+    T readings[N] = {};
+    size_t head = 0;  // Index where the next reading will be written
+    size_t count = 0;
+    size_t limit = N;
+    size_t pushesSinceResync = 0;
+    T sum = T();
+    T sumOfSquares = T();
+};
+
+#endif  // RING_WINDOW_H
@@ -0,0 +1,75 @@
+/*
+ * File: rollup.h
+ * Description: Minimum, maximum, mean and count of the readings of a time
+ *              bucket, updated one reading at a time so that the readings
+ *              themselves never need to be kept or scanned again.
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+
+struct Rollup {
+    uint32_t start;  // Unix time of the start of the bucket
+    uint32_t count;  // Number of readings, 0 for an empty bucket
+    float minTemperature;
+    float maxTemperature;
+    float sumTemperature;
+    float minHumidity;
+    float maxHumidity;
+    float sumHumidity;
+
+    // Forget the readings and start the bucket beginning at `bucketStart`
+    void reset(uint32_t bucketStart) {
+        *this = Rollup();
+        start = bucketStart;
+    }
+
+    void add(float temperature, float humidity) {
+        if (count == 0 || temperature < minTemperature) {
+            minTemperature = temperature;
+        }
+        if (count == 0 || temperature > maxTemperature) {
+            maxTemperature = temperature;
+        }
+        if (count == 0 || humidity < minHumidity) {
+            minHumidity = humidity;
+        }
+        if (count == 0 || humidity > maxHumidity) {
+            maxHumidity = humidity;
+        }
+        sumTemperature += temperature;
+        sumHumidity += humidity;
+        count++;
+    }
+
+    // Add the readings of another bucket, e.g. hours into a day
+    void merge(const Rollup &other) {
+        if (other.count == 0) {
+            return;
+        }
+        if (count == 0 || other.minTemperature < minTemperature) {
+            minTemperature = other.minTemperature;
+        }
+        if (count == 0 || other.maxTemperature > maxTemperature) {
+            maxTemperature = other.maxTemperature;
+        }
+        if (count == 0 || other.minHumidity < minHumidity) {
+            minHumidity = other.minHumidity;
+        }
+        if (count == 0 || other.maxHumidity > maxHumidity) {
+            maxHumidity = other.maxHumidity;
+        }
+        sumTemperature += other.sumTemperature;
+        sumHumidity += other.sumHumidity;
+        count += other.count;
+    }
+
+    float meanTemperature() const {
+        return count == 0 ? 0 : sumTemperature / count;
+    }
+    float meanHumidity() const { return count == 0 ? 0 : sumHumidity / count; }
+};
+
+#endif  // ROLLUP_H
@@ -0,0 +1,201 @@
+/*
+ * File: sample_filter.h
+ * Description: Smoothing filters for the sensor readings, selected at
+ *              compile time, and a spike gate that drops isolated glitches
+ *              before they reach them. All of them use a fixed amount of
+ *              memory and are constant initialized, so they can live in
+ *              RTC memory across deep sleeps.
+ */
+
+#ifndef SAMPLE_FILTER_H
+#define SAMPLE_FILTER_H
+
+#include <stddef.h>
+
+#include "ring_window.h"
+
+// Filters available for SAMPLE_FILTER
+#define FILTER_MEAN 0    // Arithmetic mean of the last N readings
+#define FILTER_MEDIAN 1  // Median of the last N readings
+#define FILTER_EMA 2     // Exponential moving average
+#define FILTER_KALMAN 3  // 1-D Kalman filter (random walk model)
+
+// Every filter has the same interface: update() adds a reading and returns
+// the new estimate, value() returns the current one. Both return T() until
+// the first reading. resize() changes the number of readings of the window
+// filters (up to N) and does nothing for the others.
+
+template <typename T, size_t N>
+class MeanFilter {
+   public:
+    T update(T value) {
+        window.push(value);
+        return window.mean();
+    }
+
+    T value() const { return window.mean(); }
+    bool empty() const { return window.empty(); }
+    void resize(size_t length) { window.resize(length); }
+
+   private:
+    RingWindow<T, N> window;
+};
+
+// Keeps the readings both in arrival order (to know which one to drop)
+// and sorted (to find the median). N is small, so shifting the sorted
+// array is cheaper than maintaining two heaps.
+template <typename T, size_t N>
+class MedianFilter {
+   public:
+    T update(T value) {
+        if (window.full()) {
+            remove(window[0]);
+        }
+        window.push(value);
+        insert(value);
+        return this->value();
+    }
+
+    T value() const {
+        size_t count = window.size();
+        if (count == 0) {
+            return T();
+        }
+        if (count % 2 == 1) {
+            return sorted[count / 2];
+        }
+        return (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    }
+
+    bool empty() const { return window.empty(); }
+
+    void resize(size_t length) {
+        window.resize(length);
+        for (size_t i = 0; i < window.size(); i++) {
+            insert(window[i], i);
+        }
+    }
+
+   private:
+    // Insert into sorted[0, used], keeping it ordered, where `used` is the
+    // number of readings already sorted (by default all but the new one)
+    void insert(T value) { insert(value, window.size() - 1); }
+
+    void insert(T value, size_t used) {
+        size_t i = used;
+        while (i > 0 && sorted[i - 1] > value) {
+            sorted[i] = sorted[i - 1];
+            i--;
+        }
+        sorted[i] = value;
+    }
+
+    void remove(T value) {
+        size_t count = window.size();
+        size_t i = 0;
+        while (i < count - 1 && sorted[i] != value) {
+            i++;
+        }
+        for (; i < count - 1; i++) {
+            sorted[i] = sorted[i + 1];
+        }
+    }
+
+    RingWindow<T, N> window;
+    T sorted[N] = {};
+};
+
+// `alpha` in (0, 1]: the weight of the newest reading
+template <typename T>
+class EmaFilter {
+   public:
+    constexpr explicit EmaFilter(T alpha) : alpha(alpha) {}
+
+    T update(T value) {
+        if (!initialized) {
+            estimate = value;
+            initialized = true;
+        } else {
+            estimate += alpha * (value - estimate);
+        }
+        return estimate;
+    }
+
+    T value() const { return estimate; }
+    bool empty() const { return !initialized; }
+    void resize(size_t) {}
+
+   private:
+    T alpha;
+    T estimate = T();
+    bool initialized = false;
+};
+
+// Models the quantity as a slow random walk. `processNoise` is how much it
+// may drift between two readings and `measurementNoise` how noisy a reading
+// is, both as variances: a larger ratio of the latter smooths more.
+template <typename T>
+class KalmanFilter {
+   public:
+    constexpr KalmanFilter(T processNoise, T measurementNoise)
+        : processNoise(processNoise), measurementNoise(measurementNoise) {}
+
+    T update(T value) {
+        if (!initialized) {
+            estimate = value;
+            errorVariance = measurementNoise;
+            initialized = true;
+            return estimate;
+        }
+
+        errorVariance += processNoise;
+        T gain = errorVariance / (errorVariance + measurementNoise);
+        estimate += gain * (value - estimate);
+        errorVariance *= 1 - gain;
+        return estimate;
+    }
+
+    T value() const { return estimate; }
+    bool empty() const { return !initialized; }
+    void resize(size_t) {}
+
+   private:
+    T processNoise;
+    T measurementNoise;
+    T estimate = T();
+    T errorVariance = T();
+    bool initialized = false;
+};
+
+// Flags readings that jump more than `maxStep` away from the last accepted
+// one. The caller decides what to do with a spike, e.g. to accept it anyway
+// after a few in a row, since that means the quantity really changed.
+// A `maxStep` of 0 disables the gate.
+template <typename T>
+class SpikeGate {
+   public:
+    constexpr explicit SpikeGate(T maxStep) : maxStep(maxStep) {}
+
+    bool isSpike(T value) const {
+        if (!hasLast || maxStep <= T()) {
+            return false;
+        }
+        T step = value > last ? value - last : last - value;
+        return step > maxStep;
+    }
+
+    void accept(T value) {
+        last = value;
+        hasLast = true;
+    }
+
+    // Last accepted reading, T() if there is none yet
+    T lastAccepted() const { return last; }
+
+   private:
+    T maxStep;
+    T last = T();
+    bool hasLast = false;
+};
+
+#endif  // SAMPLE_FILTER_H
@@ -0,0 +1,26 @@
+/*
+ * File: sensor_snapshot.h
+ * Description: Latest values of one sensor, as published by the sampling
+ *              task and encoded into the MQTT payloads.
+ */
+
+#ifndef SENSOR_SNAPSHOT_H
+#define SENSOR_SNAPSHOT_H
+
+#include <stdint.h>
+
+// Latest values produced by the sampling task
+struct SensorSnapshot {
+    float avgTemperature;     // Filtered temperature, in Celsius
+    float avgHumidity;        // Filtered relative humidity, in %
+    float rawTemperature;     // Last valid temperature reading, in Celsius
+    float rawHumidity;        // Last valid humidity reading, in %
+    uint32_t timestamp;       // millis() at the time of the reading
+    uint32_t epoch;           // Unix time of the reading, 0 if not known yet
+    uint32_t sampleCount;     // Number of readings taken since boot
+    uint32_t failedReadings;  // Readings the sensor failed since boot
+    bool sensorOk;            // Whether the last reading was used
+    uint8_t sensor;           // Index of the sensor, see sensorDefinition()
+};
+
+#endif  // SENSOR_SNAPSHOT_H
@@ -0,0 +1,68 @@
+/*
+ * File: snapshot_buffer.h
+ * Description: Lock-free, double-buffered container used to hand the latest
+ *              sensor snapshot from the single sampling task (the writer)
+ *              to any number of readers (web handlers, network task) without
+ *              taking a mutex.
+ */
+
+#ifndef SNAPSHOT_BUFFER_H
+#define SNAPSHOT_BUFFER_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Two slots are kept: the writer always fills the slot that is not currently
+// published and then flips the published generation. A reader copies the
+// published slot and only retries if the writer has already started to
+// overwrite that very slot, which requires two publishes during one copy.
+template <typename T>
+class SnapshotBuffer {
+   public:
+    // Publish a new value. Must only be called from a single writer task.
+    void publish(const T &value) {
+        uint32_t next = published.load(std::memory_order_relaxed) + 1;
+
+        // Announce which generation is being written before touching the slot
+        writing.store(next, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slots[next & 1] = value;
+
+        published.store(next, std::memory_order_release);
+    }
+
+    // Copy the latest value into `out` and return its generation.
+    // Generation 0 means nothing has been published yet and `out` is
+    // left untouched.
+    uint32_t read(T &out) const {
+        for (;;) {
+            uint32_t generation = published.load(std::memory_order_acquire);
+            if (generation == 0) {
+                return 0;
+            }
+
+            T copy = slots[generation & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // The copy is consistent unless the writer has begun the
+            // generation that reuses our slot (generation + 2)
+            if (writing.load(std::memory_order_relaxed) - generation < 2) {
+                out = copy;
+                return generation;
+            }
+        }
+    }
+
+    // Generation of the latest published value, without copying it
+    uint32_t generation() const {
+        return published.load(std::memory_order_acquire);
+    }
+
+   private:
+    T slots[2] = {};
+    std::atomic<uint32_t> published{0};
+    std::atomic<uint32_t> writing{0};
+};
+
+#endif  // SNAPSHOT_BUFFER_H
@@ -0,0 +1,79 @@
+/*
+ * File: spsc_queue.h
+ * Description: Lock-free FIFO queue between exactly one producer task and
+ *              one consumer task, possibly on different cores. Neither side
+ *              ever waits for the other: push() fails when the queue is
+ *              full and pop() when it is empty. All the storage is reserved
+ *              at compile time.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t N>
+class SpscQueue {
+    // The indices run freely and wrap around 2^32, which only lines up
+    // with the slots when N divides 2^32
+    static_assert(N > 0 && (N & (N - 1)) == 0,
+                  "SpscQueue needs a power of two capacity");
+
+   public:
+    // Add an element at the back. Producer only.
+    // Returns false, and drops `value`, if the queue is full.
+    bool push(const T &value) {
+        uint32_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        items[tail % N] = value;
+        // Publishes the element: the consumer sees it once it sees the tail
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Move the oldest element into `value`. Consumer only.
+    // Returns false, and leaves `value` untouched, if the queue is empty.
+    bool pop(T &value) {
+        uint32_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = items[head % N];
+        // Hands the slot back to the producer once it has been copied
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Oldest element, without removing it. Consumer only, and only when
+    // the queue is not empty.
+    const T &front() const {
+        return items[headIndex.load(std::memory_order_relaxed) % N];
+    }
+
+    // Remove the oldest element. Consumer only. Does nothing when empty.
+    void pop() {
+        T discarded;
+        pop(discarded);
+    }
+
+    // Exact on either side for its own operations; from the other side the
+    // queue may have changed by the time the result is used
+    size_t size() const {
+        return tailIndex.load(std::memory_order_acquire) -
+               headIndex.load(std::memory_order_acquire);
+    }
+    static constexpr size_t capacity() { return N; }
+    bool empty() const { return size() == 0; }
+
+   private:
+    T items[N] = {};
+    // Each index lives on a different word, written by one side only
+    std::atomic<uint32_t> headIndex{0};  // Next element to pop (consumer)
+    std::atomic<uint32_t> tailIndex{0};  // Next slot to fill (producer)
+};
+
+#endif  // SPSC_QUEUE_H
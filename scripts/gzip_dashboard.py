@@ -0,0 +1,61 @@
+# File: gzip_dashboard.py
+# Description: PlatformIO pre-build script that gzips web/index.html into
+#              include/index_html_gz.h as a PROGMEM byte array, together
+#              with a strong ETag derived from its content.
+#              It can also be run by hand: python scripts/gzip_dashboard.py
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+TARGET = os.path.join(PROJECT_DIR, "include", "index_html_gz.h")
+
+
+def render_header(compressed, etag):
+    lines = [
+        "// Generated by scripts/gzip_dashboard.py from web/index.html.",
+        "// Do not edit, change web/index.html instead.",
+        "",
+        "#ifndef INDEX_HTML_GZ_H",
+        "#define INDEX_HTML_GZ_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        'const char INDEX_HTML_ETAG[] = "\\"%s\\"";' % etag,
+        "const size_t INDEX_HTML_GZ_LEN = %d;" % len(compressed),
+        "const uint8_t INDEX_HTML_GZ[] PROGMEM = {",
+    ]
+    for i in range(0, len(compressed), 16):
+        chunk = compressed[i:i + 16]
+        lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    lines += ["};", "", "#endif  // INDEX_HTML_GZ_H", ""]
+    return "\n".join(lines)
+
+
+def main():
+    with open(SOURCE, "rb") as source:
+        html = source.read()
+
+    # A fixed mtime keeps the output, and thus the ETag, reproducible
+    compressed = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = hashlib.sha256(compressed).hexdigest()[:16]
+    header = render_header(compressed, etag)
+
+    # Only touch the header when the page changed, to avoid full rebuilds
+    if os.path.exists(TARGET):
+        with open(TARGET) as current:
+            if current.read() == header:
+                return
+    with open(TARGET, "w") as target:
+        target.write(header)
+    print("gzip_dashboard: %d -> %d bytes" % (len(html), len(compressed)))
+
+
+main()
@@ -0,0 +1,63 @@
+# File: load_dashboard.py
+# Description: Scripted HTTP load on the dashboard routes, to run against
+#              the profile build (env:esp32doit-devkit-v1-profile) while
+#              watching its serial log: the sample_period percentiles show
+#              whether the web traffic adds jitter to the sampling.
+#              python scripts/load_dashboard.py 192.168.1.50 --clients 4
+
+import argparse
+import threading
+import time
+import urllib.error
+import urllib.request
+
+ROUTES = ["/", "/temperature", "/humidity", "/api/readings",
+          "/api/history?step=3600", "/metrics"]
+
+
+def client(base_url, deadline, results, lock):
+    requests = 0
+    errors = 0
+    while time.monotonic() < deadline:
+        for route in ROUTES:
+            try:
+                with urllib.request.urlopen(base_url + route,
+                                            timeout=5) as response:
+                    response.read()
+                requests += 1
+            except (urllib.error.URLError, OSError):
+                errors += 1
+    with lock:
+        results["requests"] += requests
+        results["errors"] += errors
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="HTTP load on the dashboard routes of the ESP32")
+    parser.add_argument("host", help="address of the ESP32")
+    parser.add_argument("--clients", type=int, default=4,
+                        help="concurrent clients (default 4)")
+    parser.add_argument("--duration", type=float, default=60,
+                        help="seconds of load (default 60)")
+    args = parser.parse_args()
+
+    base_url = "http://" + args.host
+    deadline = time.monotonic() + args.duration
+    results = {"requests": 0, "errors": 0}
+    lock = threading.Lock()
+    threads = [threading.Thread(target=client,
+                                args=(base_url, deadline, results, lock))
+               for _ in range(args.clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    print("%d requests (%.1f/s), %d errors" %
+          (results["requests"], results["requests"] / args.duration,
+           results["errors"]))
+
+
+if __name__ == "__main__":
+    main()
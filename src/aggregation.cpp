@@ -0,0 +1,63 @@
+/*
+ * File: aggregation.cpp
+ * Description: Aggregation task, between the sampling and network tasks.
+ */
+
+#include "aggregation.h"
+
+#include <Arduino.h>
+
+#include "deadband.h"
+#include "history_store.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "rollups.h"
+#include "sampling.h"
+#include "spsc_queue.h"
+#include "task_layout.h"
+
+// Readings that left the deadband, from this task to the network task
+SpscQueue<SensorSnapshot, REPORT_QUEUE_SIZE> reportQueue;
+
+TaskHandle_t reportConsumer = nullptr;
+
+// Body of the aggregation task: sleep until the sampling task queues a
+// snapshot, then take every queued one. The flash writes of the history
+// and the rollups happen here, never in the sampling or network tasks.
+void aggregationTask(void *parameter) {
+    SensorSnapshot snapshot;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (takeSample(snapshot)) {
+            PROFILE_SCOPE(PROFILE_AGGREGATION);
+            recordHistory(snapshot);
+            recordRollups(snapshot);
+            if (!reportDue(snapshot)) {
+                continue;
+            }
+            // A dropped reading leaves the deadband where it was, so the
+            // change it carried is reported with the next sample
+            if (reportQueue.push(snapshot)) {
+                markReported(snapshot);
+                xTaskNotifyGive(reportConsumer);
+            } else {
+                countMetric(metrics.reportsDropped);
+            }
+        }
+    }
+}
+
+void startAggregationTask(TaskHandle_t network) {
+    reportConsumer = network;
+    TaskHandle_t task = nullptr;
+    xTaskCreatePinnedToCore(aggregationTask, "aggregation",
+                            AGGREGATION_TASK_STACK_SIZE, nullptr,
+                            AGGREGATION_TASK_PRIORITY, &task,
+                            AGGREGATION_TASK_CORE);
+    forwardSamples(task);
+}
+
+bool takeReport(SensorSnapshot &reading) {
+    return reportQueue.pop(reading);
+}
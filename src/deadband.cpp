@@ -0,0 +1,48 @@
+/*
+ * File: deadband.cpp
+ * Description: Report-by-exception filter for the published readings.
+ */
+
+#include "deadband.h"
+
+#include <math.h>
+
+#include "runtime_config.h"
+
+// Last published reading of every sensor
+struct ReportedReading {
+    float temperature;
+    float humidity;
+    uint32_t timestamp;
+    bool sensorOk;
+    bool valid;
+};
+
+ReportedReading lastReported[MAX_SENSORS] = {};
+
+// Whether `value` moved by more than `threshold` from `reported`.
+// A threshold of 0 treats every reading as a change.
+bool outsideDeadband(float value, float reported, float threshold) {
+    return threshold <= 0 || fabsf(value - reported) > threshold;
+}
+
+bool reportDue(const SensorSnapshot &reading) {
+    DeadbandConfig config = runtimeConfig().deadband;
+    const ReportedReading &last = lastReported[reading.sensor];
+    return !last.valid ||
+           reading.timestamp - last.timestamp >= config.heartbeatMs ||
+           reading.sensorOk != last.sensorOk ||
+           outsideDeadband(reading.avgTemperature, last.temperature,
+                           config.temperature) ||
+           outsideDeadband(reading.avgHumidity, last.humidity,
+                           config.humidity);
+}
+
+void markReported(const SensorSnapshot &reading) {
+    ReportedReading &last = lastReported[reading.sensor];
+    last.temperature = reading.avgTemperature;
+    last.humidity = reading.avgHumidity;
+    last.timestamp = reading.timestamp;
+    last.sensorOk = reading.sensorOk;
+    last.valid = true;
+}
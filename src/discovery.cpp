@@ -0,0 +1,68 @@
+/*
+ * File: discovery.cpp
+ * Description: mDNS responder and DNS-SD services of the device.
+ */
+
+#include "discovery.h"
+
+#include <Arduino.h>
+#include <ESPmDNS.h>
+#include <stdio.h>
+
+#include "log.h"
+#include "runtime_config.h"
+#include "sampling.h"
+
+char hostname[32] = "";
+bool mdnsStarted = false;
+
+const char *discoveryHostname() {
+    if (hostname[0] == '\0') {
+#ifdef MDNS_HOSTNAME
+        snprintf(hostname, sizeof(hostname), "%s", MDNS_HOSTNAME);
+#else
+        snprintf(hostname, sizeof(hostname), "esp32-%s", deviceId());
+#endif
+    }
+    return hostname;
+}
+
+bool beginMdns() {
+    if (!mdnsStarted) {
+        mdnsStarted = MDNS.begin(discoveryHostname());
+        if (!mdnsStarted) {
+            LOG_EVERY(60000, LOG_WARN("Could not start the mDNS responder"));
+        }
+    }
+    return mdnsStarted;
+}
+
+void setupDiscovery() {
+    if (!beginMdns()) {
+        return;
+    }
+    MDNS.setInstanceName(discoveryHostname());
+
+    // The dashboard, for browsers and generic service browsers
+    MDNS.addService("http", "tcp", WEB_SERVER_PORT);
+    MDNS.addServiceTxt("http", "tcp", "path", "/");
+
+    // The node, for collectors
+    char sensors[4];
+    snprintf(sensors, sizeof(sensors), "%u", (unsigned)sensorCount());
+    MDNS.addService(DISCOVERY_SERVICE_TYPE, "tcp", WEB_SERVER_PORT);
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "id", deviceId());
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "prefix",
+                       sensorDefinition(0).topicPrefix);
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "sensors", sensors);
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "config",
+                       runtimeConfigTopic());
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "readings",
+                       "/api/readings");
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "history",
+                       "/api/history");
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "events", "/events");
+    MDNS.addServiceTxt(DISCOVERY_SERVICE_TYPE, "tcp", "metrics", "/metrics");
+
+    LOG_INFO("Advertising %s.local over mDNS", discoveryHostname());
+}
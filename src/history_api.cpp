@@ -0,0 +1,261 @@
+/*
+ * File: history_api.cpp
+ * Description: Range queries on the history, streamed as a chunked
+ *              response.
+ */
+
+#include "history_api.h"
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <memory>
+
+#include "history_store.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "rollup.h"
+#include "rollup_store.h"
+#include "rollups.h"
+#include "sampling.h"
+
+// Longest line of the response: the JSON header
+const size_t HISTORY_MAX_LINE_SIZE = 256;
+
+// A query being answered. It lives as long as its response, and only
+// holds the buckets of the chunk being sent.
+struct HistoryQuery {
+    uint8_t sensor;
+    uint32_t to;
+    uint32_t step;
+    bool csv;
+    bool hourly;  // From the hourly rollups rather than the samples
+
+    uint32_t cursor;  // Start of the first bucket not aggregated yet
+    bool complete;    // No bucket left to aggregate
+    Rollup buckets[HISTORY_CHUNK_BUCKETS];
+    size_t bucketCount;
+    uint32_t lastHour;  // Start of the last stored hour aggregated
+    size_t sent;        // Buckets of the chunk already written
+    bool headerSent;
+    bool bucketSent;  // At least one bucket written, JSON needs a comma
+    bool footerSent;
+};
+
+// Bucket the readings at `epoch` belong to. Returns nullptr, leaving the
+// cursor on it, when the chunk has no room for one more bucket.
+Rollup *bucketFor(HistoryQuery &query, uint32_t epoch) {
+    uint32_t start = epoch - epoch % query.step;
+    if (query.bucketCount > 0 &&
+        query.buckets[query.bucketCount - 1].start == start) {
+        return &query.buckets[query.bucketCount - 1];
+    }
+    if (query.bucketCount == HISTORY_CHUNK_BUCKETS) {
+        query.cursor = start;
+        query.complete = false;
+        return nullptr;
+    }
+    Rollup &bucket = query.buckets[query.bucketCount++];
+    bucket.reset(start);
+    return &bucket;
+}
+
+bool addSample(const HistorySample &sample, void *context) {
+    Rollup *bucket = bucketFor(*static_cast<HistoryQuery *>(context),
+                               sample.epoch);
+    if (bucket == nullptr) {
+        return false;
+    }
+    bucket->add(sample.temperature, sample.humidity);
+    return true;
+}
+
+bool addRollup(const Rollup &rollup, void *context) {
+    HistoryQuery &query = *static_cast<HistoryQuery *>(context);
+    Rollup *bucket = bucketFor(query, rollup.start);
+    if (bucket == nullptr) {
+        return false;
+    }
+    bucket->merge(rollup);
+    query.lastHour = rollup.start;
+    return true;
+}
+
+// Aggregate the next buckets, from the cursor on
+void aggregateChunk(HistoryQuery &query) {
+    uint32_t from = query.cursor;
+    query.bucketCount = 0;
+    query.sent = 0;
+    query.complete = true;  // Unless a bucket does not fit
+    if (query.hourly) {
+        query.lastHour = 0;
+        readRollups(query.sensor, from, query.to, addRollup, &query);
+
+        // Then the current hour, unless it has just been stored
+        Rollup hour;
+        if (query.complete && currentRollup(query.sensor, ROLLUP_HOUR, hour) &&
+            hour.start >= from && hour.start <= query.to &&
+            hour.start > query.lastHour) {
+            addRollup(hour, &query);
+        }
+    } else {
+        readHistory(query.sensor, from, query.to, addSample, &query);
+    }
+}
+
+int formatHeader(const HistoryQuery &query, char *line, size_t size) {
+    if (query.csv) {
+        return snprintf(line, size,
+                        "start,count,temperature_min,temperature_mean,"
+                        "temperature_max,humidity_min,humidity_mean,"
+                        "humidity_max\n");
+    }
+    return snprintf(line, size,
+                    "{\"sensor\":%u,\"step\":%u,\"columns\":[\"start\","
+                    "\"count\",\"temperature_min\",\"temperature_mean\","
+                    "\"temperature_max\",\"humidity_min\","
+                    "\"humidity_mean\",\"humidity_max\"],\"buckets\":[",
+                    query.sensor, query.step);
+}
+
+int formatBucket(const HistoryQuery &query, const Rollup &bucket,
+                 bool first, char *line, size_t size) {
+    const char *format = query.csv
+                             ? "%s%u,%u,%.1f,%.2f,%.1f,%.1f,%.2f,%.1f\n"
+                             : "%s[%u,%u,%.1f,%.2f,%.1f,%.1f,%.2f,%.1f]";
+    const char *separator = query.csv || first ? "" : ",";
+    return snprintf(line, size, format, separator, bucket.start,
+                    bucket.count, bucket.minTemperature,
+                    bucket.meanTemperature(), bucket.maxTemperature,
+                    bucket.minHumidity, bucket.meanHumidity(),
+                    bucket.maxHumidity);
+}
+
+// Fill one chunk of the response: whole lines only, aggregating at most
+// one more set of buckets, so each call stays short for the TCP task
+size_t fillChunk(HistoryQuery &query, uint8_t *buffer, size_t maxLength) {
+    char line[HISTORY_MAX_LINE_SIZE];
+    size_t length = 0;
+    bool aggregated = false;
+
+    for (;;) {
+        int lineLength;
+        if (!query.headerSent) {
+            lineLength = formatHeader(query, line, sizeof(line));
+        } else if (query.sent < query.bucketCount) {
+            lineLength = formatBucket(query, query.buckets[query.sent],
+                                      !query.bucketSent, line, sizeof(line));
+        } else if (!query.complete) {
+            if (aggregated) {
+                break;
+            }
+            aggregateChunk(query);
+            aggregated = true;
+            continue;
+        } else if (!query.footerSent) {
+            lineLength = snprintf(line, sizeof(line), "%s",
+                                  query.csv ? "" : "]}\n");
+        } else {
+            break;
+        }
+
+        if (length + lineLength > maxLength) {
+            break;
+        }
+        memcpy(buffer + length, line, lineLength);
+        length += lineLength;
+
+        if (!query.headerSent) {
+            query.headerSent = true;
+        } else if (query.sent < query.bucketCount) {
+            query.sent++;
+            query.bucketSent = true;
+        } else {
+            query.footerSent = true;
+        }
+    }
+
+    // Wait for more room rather than ending the response, which an empty
+    // chunk would do
+    if (length == 0 && !query.footerSent) {
+        return RESPONSE_TRY_AGAIN;
+    }
+    return length;
+}
+
+// Read an optional, unsigned integer parameter.
+// Returns false if it is present but not a number.
+bool readParam(AsyncWebServerRequest *request, const char *name,
+               uint32_t &value) {
+    if (!request->hasParam(name)) {
+        return true;
+    }
+    const char *text = request->getParam(name)->value().c_str();
+    char *end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (text[0] == '\0' || *end != '\0') {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+void handleHistory(AsyncWebServerRequest *request) {
+    countMetric(metrics.httpRequests[ROUTE_API_HISTORY]);
+    PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_API_HISTORY);
+
+    uint32_t sensor = 0;
+    uint32_t to = time(nullptr);
+    bool toGiven = request->hasParam("to");
+    if (!readParam(request, "sensor", sensor) ||
+        !readParam(request, "to", to)) {
+        request->send(400, "application/json",
+                      "{\"error\":\"invalid parameter\"}");
+        return;
+    }
+    uint32_t from = to > HISTORY_DEFAULT_RANGE_S
+                        ? to - HISTORY_DEFAULT_RANGE_S
+                        : 0;
+    uint32_t step = HISTORY_DEFAULT_STEP_S;
+    if (!readParam(request, "from", from) ||
+        !readParam(request, "step", step) || from > to ||
+        step < HISTORY_MIN_STEP_S) {
+        request->send(400, "application/json",
+                      "{\"error\":\"invalid parameter\"}");
+        return;
+    }
+    if (sensor >= sensorCount()) {
+        request->send(404, "application/json",
+                      "{\"error\":\"unknown sensor\"}");
+        return;
+    }
+    if (!toGiven && to < MIN_VALID_EPOCH) {
+        request->send(503, "application/json",
+                      "{\"error\":\"time not synchronized\"}");
+        return;
+    }
+
+    std::shared_ptr<HistoryQuery> query = std::make_shared<HistoryQuery>();
+    query->sensor = sensor;
+    query->to = to;
+    query->step = step;
+    query->csv = request->hasParam("format") &&
+                 request->getParam("format")->value() == "csv";
+    query->hourly = step % ROLLUP_PERIOD_S == 0;
+    query->cursor = from - from % step;
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse(
+        query->csv ? "text/csv" : "application/json",
+        [query](uint8_t *buffer, size_t maxLength, size_t index) -> size_t {
+            return fillChunk(*query, buffer, maxLength);
+        });
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+void setupHistoryApi(AsyncWebServer &server) {
+    server.on("/api/history", HTTP_GET, handleHistory);
+}
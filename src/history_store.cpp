@@ -0,0 +1,335 @@
+/*
+ * File: history_store.cpp
+ * Description: Compressed, flash-backed history of the readings.
+ *
+ * Every page starts with a header holding its first sample in full; the
+ * following samples are compressed relative to the previous one (see
+ * history_codec.h). Pages are only written as a whole, to the slot after
+ * the newest one: on boot, the slot with the highest sequence number tells
+ * where to continue.
+ */
+
+#include "history_store.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/semphr.h>
+#include <math.h>
+#include <string.h>
+
+#include "bit_stream.h"
+#include "history_codec.h"
+#include "log.h"
+
+// Path of the ring file
+const char *HISTORY_PATH = "/history.bin";
+
+// Identifies a written page; an unwritten slot never matches it
+const uint32_t HISTORY_MAGIC = 0x48495354;  // "HIST"
+
+struct HistoryPageHeader {
+    uint32_t magic;
+    uint32_t sequence;    // Increases with every slot taken
+    uint32_t firstEpoch;  // Unix time of the first sample
+    uint32_t lastEpoch;   // Unix time of the last sample
+    int16_t firstTemperature;
+    int16_t firstHumidity;
+    uint16_t count;  // Number of samples, including the first one
+    uint8_t sensor;
+    uint8_t reserved;
+};
+
+struct HistoryPage {
+    HistoryPageHeader header;
+    uint8_t data[HISTORY_PAGE_DATA_SIZE];
+};
+
+static_assert(sizeof(HistoryPageHeader) == HISTORY_PAGE_HEADER_SIZE,
+              "The header size is part of the page layout");
+static_assert(sizeof(HistoryPage) == HISTORY_PAGE_SIZE,
+              "History pages must have a fixed size");
+
+// Page being filled for one sensor, and what is needed to encode the next
+// sample relative to the last one
+struct PageWriter {
+    HistoryPage page;
+    uint32_t slot;
+    size_t bits;
+    HistoryCursor last;
+    bool open;
+    bool placed;  // Has taken `slot`, on its first write to flash
+    bool dirty;   // Has samples not written to flash yet
+};
+
+PageWriter writers[MAX_SENSORS] = {};
+
+File historyFile;
+bool historyReady = false;
+
+// Slot and sequence number of the next page written to flash
+uint32_t nextSlot = 0;
+uint32_t nextSequence = 1;
+
+// Time of the last flush of the pages being filled
+unsigned long lastFlushTime = 0;
+
+// Guards the file and the writers: readers may run in another task
+SemaphoreHandle_t historyLock = nullptr;
+
+// Serializes readers, which share one page buffer to keep it off the stack
+SemaphoreHandle_t readerLock = nullptr;
+HistoryPage readerPage;
+
+int16_t quantize(float value) {
+    float tenths = roundf(value / HISTORY_RESOLUTION);
+    if (tenths > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (tenths < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return tenths;
+}
+
+// Number of slots the file holds so far (it grows until HISTORY_PAGES)
+uint32_t slotsInFile() {
+    uint32_t slots = historyFile.size() / HISTORY_PAGE_SIZE;
+    return slots < HISTORY_PAGES ? slots : HISTORY_PAGES;
+}
+
+// Whether `slot` holds a page still being filled, whose copy in RAM is
+// newer than the one in flash
+bool slotOpen(uint32_t slot) {
+    for (const PageWriter &writer : writers) {
+        if (writer.open && writer.placed && writer.slot == slot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readPageHeader(uint32_t slot, HistoryPageHeader &header) {
+    historyFile.seek(slot * HISTORY_PAGE_SIZE, SeekSet);
+    return historyFile.read(reinterpret_cast<uint8_t *>(&header),
+                            sizeof(header)) == sizeof(header) &&
+           header.magic == HISTORY_MAGIC;
+}
+
+// Read the samples of a page, after its header
+bool readPageData(uint32_t slot, HistoryPage &page) {
+    historyFile.seek(slot * HISTORY_PAGE_SIZE + sizeof(page.header),
+                     SeekSet);
+    return historyFile.read(page.data, sizeof(page.data)) ==
+           sizeof(page.data);
+}
+
+// Write a page to its slot. A page takes the next slot (and sequence
+// number) on its first write, not when it is opened: with several sensors
+// the pages are written in another order than they were opened, and the
+// slots must follow the writes so that the file never has a hole and a
+// page lost in a power cut never leaves a stale one behind.
+void writePage(PageWriter &writer) {
+    if (!writer.placed) {
+        writer.slot = nextSlot;
+        nextSlot = (nextSlot + 1) % HISTORY_PAGES;
+        writer.page.header.sequence = nextSequence++;
+        writer.placed = true;
+    }
+    historyFile.seek(writer.slot * HISTORY_PAGE_SIZE, SeekSet);
+    historyFile.write(reinterpret_cast<const uint8_t *>(&writer.page),
+                      sizeof(writer.page));
+    historyFile.flush();
+}
+
+void setupHistory() {
+    historyLock = xSemaphoreCreateMutex();
+    readerLock = xSemaphoreCreateMutex();
+
+    if (!LittleFS.exists(HISTORY_PATH)) {
+        File created = LittleFS.open(HISTORY_PATH, "w");
+        created.close();
+    }
+    historyFile = LittleFS.open(HISTORY_PATH, "r+");
+    if (!historyFile) {
+        LOG_ERROR("Failed to open the history file, no history");
+        return;
+    }
+
+    // Continue after the newest page. Reading the headers only takes a
+    // few milliseconds, even with the file full.
+    uint32_t slots = slotsInFile();
+    uint32_t newestSequence = 0;
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        HistoryPageHeader header;
+        if (readPageHeader(slot, header) &&
+            header.sequence >= newestSequence) {
+            newestSequence = header.sequence;
+            nextSlot = (slot + 1) % HISTORY_PAGES;
+            nextSequence = header.sequence + 1;
+        }
+    }
+    historyReady = true;
+    LOG_INFO("History: %u pages in flash", slots);
+}
+
+// Start a new page, with the given reading as its first sample
+void openPage(PageWriter &writer, uint8_t sensor, uint32_t epoch,
+              int16_t temperature, int16_t humidity) {
+    memset(&writer.page, 0, sizeof(writer.page));
+    HistoryPageHeader &header = writer.page.header;
+    header.magic = HISTORY_MAGIC;
+    header.firstEpoch = epoch;
+    header.lastEpoch = epoch;
+    header.firstTemperature = temperature;
+    header.firstHumidity = humidity;
+    header.count = 1;
+    header.sensor = sensor;
+
+    // The slot is taken on the first write, see writePage()
+    writer.placed = false;
+    writer.bits = 0;
+    writer.last = {epoch, 0, temperature, humidity};
+    writer.open = true;
+    writer.dirty = true;
+}
+
+// Append a sample to an open page. Returns false if the page is full.
+bool appendSample(PageWriter &writer, uint32_t epoch, int16_t temperature,
+                  int16_t humidity) {
+    BitWriter bits(writer.page.data, sizeof(writer.page.data), writer.bits);
+    if (writer.page.header.count == UINT16_MAX ||
+        !encodeHistorySample(bits, writer.last, epoch, temperature,
+                             humidity)) {
+        return false;
+    }
+
+    writer.bits = bits.bitsWritten();
+    writer.page.header.lastEpoch = epoch;
+    writer.page.header.count++;
+    writer.dirty = true;
+    return true;
+}
+
+void recordHistory(const SensorSnapshot &reading) {
+    // A failed read repeats the previous values, which are already stored
+    if (!historyReady || reading.epoch == 0 || !reading.sensorOk) {
+        return;
+    }
+    int16_t temperature = quantize(reading.avgTemperature);
+    int16_t humidity = quantize(reading.avgHumidity);
+
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    PageWriter &writer = writers[reading.sensor];
+    if (!writer.open) {
+        openPage(writer, reading.sensor, reading.epoch, temperature,
+                 humidity);
+    } else if (!appendSample(writer, reading.epoch, temperature, humidity)) {
+        // The page is full: write it once and for all, start the next one
+        writePage(writer);
+        openPage(writer, reading.sensor, reading.epoch, temperature,
+                 humidity);
+    }
+    xSemaphoreGive(historyLock);
+
+    if (millis() - lastFlushTime >= HISTORY_FLUSH_INTERVAL_MS) {
+        flushHistory();
+    }
+}
+
+void flushHistory() {
+    if (!historyReady) {
+        return;
+    }
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    for (PageWriter &writer : writers) {
+        if (writer.open && writer.dirty) {
+            writePage(writer);
+            writer.dirty = false;
+        }
+    }
+    lastFlushTime = millis();
+    xSemaphoreGive(historyLock);
+}
+
+// Decode a page and visit its samples within [from, to].
+// Returns false if the visitor asked to stop.
+bool visitPage(const HistoryPage &page, uint32_t from, uint32_t to,
+               HistoryVisitor visitor, void *context, size_t &visited) {
+    const HistoryPageHeader &header = page.header;
+    BitReader bits(page.data, sizeof(page.data) * 8);
+    HistoryCursor cursor = {header.firstEpoch, 0, header.firstTemperature,
+                            header.firstHumidity};
+
+    for (uint16_t i = 0; i < header.count; i++) {
+        if (i > 0 && !decodeHistorySample(bits, cursor)) {
+            return true;  // Corrupted page: skip the rest of it
+        }
+        if (cursor.epoch < from) {
+            continue;
+        }
+        if (cursor.epoch > to) {
+            return false;
+        }
+
+        HistorySample sample = {cursor.epoch,
+                                cursor.temperature * HISTORY_RESOLUTION,
+                                cursor.humidity * HISTORY_RESOLUTION};
+        visited++;
+        if (!visitor(sample, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t readHistory(uint8_t sensor, uint32_t from, uint32_t to,
+                   HistoryVisitor visitor, void *context) {
+    if (!historyReady || sensor >= MAX_SENSORS) {
+        return 0;
+    }
+
+    // Pages are visited in the order they were first written, from the
+    // slot after the newest one; for one sensor that is the order they
+    // were opened in. Only the headers of the pages out of the range
+    // are read. The others are copied under the lock and decoded outside of
+    // it, so the aggregation task is never held up for long.
+    xSemaphoreTake(readerLock, portMAX_DELAY);
+    HistoryPage &page = readerPage;
+
+    size_t visited = 0;
+    bool more = true;
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    uint32_t slots = slotsInFile();
+    uint32_t oldest = slots < HISTORY_PAGES ? 0 : nextSlot;
+    xSemaphoreGive(historyLock);
+
+    for (uint32_t i = 0; i < slots && more; i++) {
+        uint32_t slot = (oldest + i) % slots;
+        // The page being filled is read from RAM below
+        xSemaphoreTake(historyLock, portMAX_DELAY);
+        bool found = !slotOpen(slot) && readPageHeader(slot, page.header) &&
+                     page.header.sensor == sensor &&
+                     page.header.lastEpoch >= from &&
+                     page.header.firstEpoch <= to && readPageData(slot, page);
+        xSemaphoreGive(historyLock);
+
+        if (found) {
+            more = visitPage(page, from, to, visitor, context, visited);
+        }
+    }
+
+    if (more) {
+        xSemaphoreTake(historyLock, portMAX_DELAY);
+        bool open = writers[sensor].open;
+        if (open) {
+            page = writers[sensor].page;
+        }
+        xSemaphoreGive(historyLock);
+        if (open) {
+            visitPage(page, from, to, visitor, context, visited);
+        }
+    }
+
+    xSemaphoreGive(readerLock);
+    return visited;
+}
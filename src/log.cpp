@@ -0,0 +1,99 @@
+/*
+ * File: log.cpp
+ * Description: Ring buffer and writer task behind the logging macros.
+ */
+
+#include "log.h"
+
+#include <stdarg.h>
+
+#include "task_layout.h"
+
+// Ring buffer shared by every task that logs. A spinlock protects it; it is
+// only held while copying a formatted message in or a chunk out.
+char logBuffer[LOG_BUFFER_SIZE];
+size_t logHead = 0;   // Next byte to write to Serial
+size_t logCount = 0;  // Bytes waiting in the buffer
+uint32_t droppedMessages = 0;
+portMUX_TYPE logLock = portMUX_INITIALIZER_UNLOCKED;
+
+TaskHandle_t loggerTask = nullptr;
+
+// Take the next contiguous chunk out of the buffer
+size_t takeLogChunk(char *chunk, size_t size, uint32_t &dropped) {
+    portENTER_CRITICAL(&logLock);
+    size_t length = logCount;
+    if (length > LOG_BUFFER_SIZE - logHead) {
+        length = LOG_BUFFER_SIZE - logHead;  // Stop at the wrap around
+    }
+    if (length > size) {
+        length = size;
+    }
+    memcpy(chunk, logBuffer + logHead, length);
+    logHead = (logHead + length) % LOG_BUFFER_SIZE;
+    logCount -= length;
+    dropped = droppedMessages;
+    droppedMessages = 0;
+    portEXIT_CRITICAL(&logLock);
+    return length;
+}
+
+// Body of the logger task: sleep until messages are queued, then write them
+void loggerTaskBody(void *parameter) {
+    char chunk[128];
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t dropped = 0;
+        size_t length;
+        while ((length = takeLogChunk(chunk, sizeof(chunk), dropped)) > 0) {
+            Serial.write(reinterpret_cast<const uint8_t *>(chunk), length);
+        }
+        if (dropped > 0) {
+            Serial.printf("[log] %u messages dropped\n", dropped);
+        }
+    }
+}
+
+void startLogger() {
+    xTaskCreatePinnedToCore(loggerTaskBody, "logger", LOGGER_TASK_STACK_SIZE,
+                            nullptr, LOGGER_TASK_PRIORITY, &loggerTask,
+                            LOGGER_TASK_CORE);
+}
+
+void logMessage(char level, const char *format, ...) {
+    char message[LOG_MAX_MESSAGE_SIZE];
+    int prefix = snprintf(message, sizeof(message), "[%8lu][%c] ", millis(),
+                          level);
+
+    va_list arguments;
+    va_start(arguments, format);
+    int body = vsnprintf(message + prefix, sizeof(message) - prefix, format,
+                         arguments);
+    va_end(arguments);
+
+    size_t length = prefix + (body < 0 ? 0 : body);
+    if (length > sizeof(message) - 2) {
+        length = sizeof(message) - 2;  // Truncated, keep room for the newline
+    }
+    message[length++] = '\n';
+
+    // Before the task runs (early boot, low-power mode) write directly
+    if (loggerTask == nullptr) {
+        Serial.write(reinterpret_cast<const uint8_t *>(message), length);
+        return;
+    }
+
+    portENTER_CRITICAL(&logLock);
+    if (LOG_BUFFER_SIZE - logCount < length) {
+        droppedMessages++;
+        length = 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        logBuffer[(logHead + logCount + i) % LOG_BUFFER_SIZE] = message[i];
+    }
+    logCount += length;
+    portEXIT_CRITICAL(&logLock);
+
+    xTaskNotifyGive(loggerTask);
+}
@@ -11,313 +11,551 @@
  */
 
 // Include the necessary headers/libraries
-#include <Adafruit_Sensor.h>
 #include <Arduino.h>
-#include <DHT.h>
-#include <PubSubClient.h>
 #include <WiFi.h>
-#include <deque>  // To be able to add and remove elements from both ends
-#include <numeric>
 #include "ESPAsyncWebServer.h"
+#include "aggregation.h"
+#include "backoff.h"
+#include "deadband.h"
+#include "discovery.h"
+#include "fixed_queue.h"
+#include "history_api.h"
+#include "history_store.h"
+// Web page served by the ESP32 microcontroller. It is written in
+// web/index.html and gzipped into this header by scripts/gzip_dashboard.py
+// at build time, together with its ETag.
+#include "index_html_gz.h"
+#include "log.h"
+#include "metrics.h"
+#include "mqtt_connection.h"
+#include "ota_update.h"
+#include "payload.h"
+#include "profiler.h"
+#include "publish_queue.h"
+#include "rollup_store.h"
+#include "rollups.h"
+#include "runtime_config.h"
+#include "sampling.h"
+#include "task_layout.h"
+#include "wifi_connection.h"
 
 // Wifi details: SSID and password
 const char *ssid = "joaoalex1";
 const char *password = "joao1579";
 
-// MQTT broker details: IP address and port
+// MQTT broker details: IP address, host name or mDNS name (e.g.
+// "broker.local"), and port. Names are resolved once, see mqtt_connection.h
 const char *mqttServer = "192.168.29.165";
 const int mqttPort = 1883;
 
-// DHT11 sensor details: pin and type
-const int DHTPIN = 4;
-const int DHTTYPE = DHT11;
-DHT dht(DHTPIN, DHTTYPE);
+// Generation of the last snapshot of each sensor sent to the web pages
+uint32_t lastSentGenerations[MAX_SENSORS] = {};
 
-// Deque to store the last temperature and humidity readings
-// and calculate the moving average
-std::deque<float> temperatureReadings;
-std::deque<float> humidityReadings;
+// Time of the last batch message, when batching is enabled
+unsigned long lastBatchFlushTime = 0;
 
-// Size of the moving average, i.e., how many readings to consider
-const int MOVING_AVERAGE_SIZE = 10;
-
-// Time to keep track of the last reading
-unsigned long lastReadingTime = 0;
+// Preallocated buffer for batch messages
+uint8_t batchPayload[MAX_PAYLOAD_SIZE * MAX_BATCH_SAMPLES];
 
 // Create an instance of the AsyncWebServer class
 // to serve the web page
-AsyncWebServer server(80);
+AsyncWebServer server(WEB_SERVER_PORT);
+
+// Server-Sent Events endpoint, pushing every new reading to the open pages
+AsyncEventSource events("/events");
 
-// WifiClient and PubSubClient instances,
-// to connect to the MQTT broker
-WiFiClient espClient;
-PubSubClient client(espClient);
+// Task running networkRound(), see task_layout.h
+TaskHandle_t networkTaskHandle = nullptr;
 
 // Function to setup the Wi-Fi connection
+// The connection is event driven and reuses the access point and IP address
+// of the last boot when possible, see wifi_connection.h
 void setupWifi() {
-    delay(10);
-    Serial.println("Connecting to " + String(ssid) + "...");
-    WiFi.begin(ssid, password);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(1000);
-        Serial.println("Connecting...");
-    }
-    Serial.println("Connected to " + String(ssid) + " network!");
+    LOG_INFO("Connecting to %s...", ssid);
+    WiFi.setHostname(discoveryHostname());  // Name shown by the DHCP server
+    beginWifi(ssid, password);
+    waitForWifi(portMAX_DELAY);
+    LOG_INFO("Connected to %s network, local IP address %s", ssid,
+             WiFi.localIP().toString().c_str());
 }
 
-// Function to reconnect to the MQTT broker
-void reconnect() {
-    while (!client.connected()) {
-        Serial.print("Trying to connect to MQTT broker...");
-        if (client.connect("ESP32Client")) {
-            Serial.println("Connected!");
-        } else {
-            Serial.print("Failed, rc=");
-            Serial.print(client.state());
-            Serial.println(" Retrying in 5 seconds...");
-            delay(5000);
-        }
+// Called by maintainMqtt() for every message received from the broker:
+// the retained config of this device, which the broker delivers right
+// after every (re)connection, and firmware update requests (with
+// OTA_PASSWORD only).
+void onMqttMessage(const char *topic, const uint8_t *payload, size_t length) {
+    bool config = strcmp(topic, runtimeConfigTopic()) == 0;
+#ifdef OTA_PASSWORD
+    bool update = strcmp(topic, otaTopic()) == 0;
+#else
+    bool update = false;
+#endif
+    if (!config && !update) {
+        return;
+    }
+
+    char json[MQTT_MAX_INBOUND_SIZE];
+    if (length >= sizeof(json)) {
+        LOG_WARN("Ignoring oversized config on %s", topic);
+        return;
+    }
+    memcpy(json, payload, length);
+    json[length] = '\0';
+
+#ifdef OTA_PASSWORD
+    if (update) {
+        startHttpOta(json);
+        return;
     }
+#endif
+    if (!applyRuntimeConfig(json)) {
+        LOG_WARN("Ignoring invalid config on %s", topic);
+    }
+}
+
+// Called by maintainMqtt() once connected to the broker
+void onMqttConnect() {
+    mqttSubscribe(runtimeConfigTopic());
+#ifdef OTA_PASSWORD
+    mqttSubscribe(otaTopic());
+#endif
 }
 
-// Read the temperature from the DHT11 sensor and
-// calculate the moving average of the last readings
-float readTemperatureAndCalculateMovingAverage() {
-    float currentTemperature = dht.readTemperature();
-    // If the reading is NaN, return the last valid reading
-    if (isnan(currentTemperature)) {
-        return temperatureReadings.back();
+// Publish a reading to the MQTT broker. Called by the publish queue.
+// By default a reading goes out as a single combined message (JSON, or CBOR
+// with -D PAYLOAD_FORMAT=PAYLOAD_CBOR) so both metrics arrive atomically.
+// PAYLOAD_LEGACY keeps the per-metric plain-text topics.
+// Readings that were held back during an outage go to a separate backfill
+// topic, their payload carrying the original timestamp.
+// Every sensor has its own topics, under its topic prefix.
+bool publishReading(const SensorSnapshot &reading, bool backfill) {
+    float avgTemperature = reading.avgTemperature;
+    float avgHumidity = reading.avgHumidity;
+
+    // Name of the topics to publish the values
+    const char *prefix = sensorDefinition(reading.sensor).topicPrefix;
+    char readingTopic[64];
+    snprintf(readingTopic, sizeof(readingTopic), "%s/reading", prefix);
+    char backfillTopic[64];
+    snprintf(backfillTopic, sizeof(backfillTopic), "%s/backfill", prefix);
+    char avgTempTopic[64];
+    snprintf(avgTempTopic, sizeof(avgTempTopic),
+             "%s/moving_average_temperature", prefix);
+    char avgHumTopic[64];
+    snprintf(avgHumTopic, sizeof(avgHumTopic), "%s/moving_average_humidity",
+             prefix);
+
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    if (backfill) {
+        size_t length = encodeReading(reading, payload, sizeof(payload));
+        return mqttPublish(backfillTopic, payload, length);
     }
 
-    // Add the current reading to the readings deque
-    temperatureReadings.push_back(currentTemperature);
+    bool published;
+    if (PAYLOAD_FORMAT != PAYLOAD_LEGACY) {
+        size_t length = encodeReading(reading, payload, sizeof(payload));
+        published = mqttPublish(readingTopic, payload, length);
+    } else {
+        // Convert the float values to strings
+        char avgTempStr[8];
+        dtostrf(avgTemperature, 2, 2, avgTempStr);
+        char avgHumStr[8];
+        dtostrf(avgHumidity, 2, 2, avgHumStr);
 
-    // If we have more readings than we want to consider for the moving average,
-    // remove the oldest one
-    if (temperatureReadings.size() > MOVING_AVERAGE_SIZE) {
-        temperatureReadings.pop_front();
+        // Publish the values to the MQTT broker
+        published = mqttPublish(avgTempTopic, avgTempStr) &&
+                    mqttPublish(avgHumTopic, avgHumStr);
     }
 
-    // Calculate the sum of the readings
-    float sum = std::accumulate(temperatureReadings.begin(),
-                                temperatureReadings.end(), 0.0f);
+    // One line per reading, compiled out unless debugging
+    LOG_DEBUG("%s reading %u: avg temp. %.2f, avg humid. %.2f, published: %s",
+              sensorDefinition(reading.sensor).name, reading.sampleCount,
+              avgTemperature, avgHumidity, published ? "yes" : "no");
 
-    // Calculate and return the moving average
-    return sum / temperatureReadings.size();
+    return published;
 }
 
-// Read the humidity from the DHT11 sensor and
-// calculate the moving average of the last readings
-float readHumidityAndCalculateMovingAverage() {
-    float currentHumidity = dht.readHumidity();
-    // If the reading is NaN, return the last valid reading
-    if (isnan(currentHumidity)) {
-        return humidityReadings.back();
+// Publish readings as array messages, which carry their timestamps, on the
+// "<prefix>/readings" topic of their sensor: one message per run of
+// consecutive readings of the same sensor. Stops at the first failure.
+// Returns how many readings were published.
+size_t publishBatch(const SensorSnapshot *readings, size_t count) {
+    size_t published = 0;
+    while (published < count) {
+        uint8_t sensor = readings[published].sensor;
+        size_t run = 1;
+        while (published + run < count &&
+               readings[published + run].sensor == sensor) {
+            run++;
+        }
+
+        char topic[64];
+        snprintf(topic, sizeof(topic), "%s/readings",
+                 sensorDefinition(sensor).topicPrefix);
+        size_t length = encodeReadings(readings + published, run,
+                                       batchPayload, sizeof(batchPayload));
+        if (!mqttPublish(topic, batchPayload, length)) {
+            break;
+        }
+        published += run;
     }
+    return published;
+}
 
-    // Add the current reading to the readings deque
-    humidityReadings.push_back(currentHumidity);
+// Publish queued readings to the MQTT broker. Called by the publish queue.
+// With batching enabled the readings go out as batch messages. Otherwise
+// every reading is published on its own. Returns how many readings were
+// published.
+size_t publishReadings(const SensorSnapshot *readings, size_t count,
+                       bool lastIsLive) {
+    if (runtimeConfig().batchSamples > 1) {
+        size_t published = publishBatch(readings, count);
+        if (published > 0) {
+            lastBatchFlushTime = millis();
+        }
+        return published;
+    }
 
-    // If we have more readings than we want to consider for the moving average,
-    // remove the oldest one
-    if (humidityReadings.size() > MOVING_AVERAGE_SIZE) {
-        humidityReadings.pop_front();
+    for (size_t i = 0; i < count; i++) {
+        bool backfill = !(lastIsLive && i == count - 1);
+        if (!publishReading(readings[i], backfill)) {
+            return i;
+        }
     }
+    return count;
+}
 
-    // Calculate the sum of the readings
-    float sum =
-        std::accumulate(humidityReadings.begin(), humidityReadings.end(), 0.0f);
+// Whether the queued readings should be published now. Without batching
+// they always are; with batching once a full batch is queued or when the
+// flush interval has elapsed.
+bool publishDue(const RuntimeConfig &config) {
+    if (config.batchSamples <= 1) {
+        return true;
+    }
+    size_t pending = pendingReadings();
+    return pending >= config.batchSamples ||
+           (pending > 0 &&
+            millis() - lastBatchFlushTime >= config.batchFlushMs);
+}
 
-    // Calculate and return the moving average
-    return sum / humidityReadings.size();
+// Publish a closed rollup on the topic of its resolution, e.g.
+// "esp32/rollup/1h". Called by drainRollups().
+bool publishRollup(const ClosedRollup &closed) {
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%s/rollup/%s",
+             sensorDefinition(closed.sensor).topicPrefix,
+             ROLLUP_NAMES[closed.resolution]);
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    size_t length =
+        encodeRollup(closed.sensor, ROLLUP_PERIODS_S[closed.resolution],
+                     closed.rollup, payload, sizeof(payload));
+    return mqttPublish(topic, payload, length);
 }
 
-// HTML code for the web page served by the ESP32 microcontroller
-// The placeholders %TEMPERATURE% and %HUMIDITY% will be replaced by the actual
-// values
-const char index_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE HTML><html>
-<script src="https://kit.fontawesome.com/1b6e98d141.js" crossorigin="anonymous"></script>
-<head>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <style>
-  body {
-    font-family: Arial, sans-serif;
-    background-color: #121212;
-    color: #ffffff;
-    margin: 0;
-    padding: 0;
-    display: flex;
-    flex-direction: column;
-    align-items: center;
-    justify-content: center;
-    height: 100vh;
+#ifdef LOW_POWER_MODE
+// Low-power mode (env:esp32doit-devkit-v1-lowpower): there is no web server
+// and no sampling task. Every wake-up takes one reading; every
+// PUBLISH_BATCH_SAMPLES readings Wi-Fi is turned on just long enough to
+// publish them as one batch. In between the ESP32 stays in deep sleep.
+#include <esp_sleep.h>
+
+#ifndef LOW_POWER_SAMPLE_INTERVAL_MS
+#define LOW_POWER_SAMPLE_INTERVAL_MS 60000
+#endif
+
+// Give up on Wi-Fi or the broker after this long, to save the battery
+const uint32_t LOW_POWER_CONNECT_TIMEOUT_MS = 10000;
+
+// The DHT11 needs about a second after power-up before the first reading
+const uint32_t DHT_POWER_UP_DELAY_MS = 1500;
+
+// Readings waiting to be published, kept in RTC memory during deep sleep
+RTC_DATA_ATTR FixedQueue<SensorSnapshot, PUBLISH_BATCH_SAMPLES> sleepBatch;
+
+// Connect, publish the pending batch and disconnect.
+// Returns true if the batch was published.
+bool publishSleepBatch() {
+    beginWifi(ssid, password);
+    if (!waitForWifi(LOW_POWER_CONNECT_TIMEOUT_MS)) {
+        return false;
     }
-    .header { display: flex; align-items: center; gap: 20px; }
-    .header img { width: 160px; height: auto; }
-    .header h2 { font-size: 2.5rem; color: #ffffff; }
-    p { background-color: #1f1f1f; border-radius: 5px; padding: 20px; margin: 10px; width: 80vw; display: flex; align-items: center; justify-content: space-between; }
-    .units { font-size: 1rem; }
-    .fa-solid, .fas { margin-right: 10px; }
-    .dht-labels{
-      flex-grow: 1;
-      text-transform: uppercase;
-      letter-spacing: 1px;
+
+    beginMqtt(mqttServer, mqttPort, "ESP32Client", nullptr, nullptr);
+    if (!connectMqtt(LOW_POWER_CONNECT_TIMEOUT_MS)) {
+        return false;
     }
-    footer {
-      position: fixed;
-      left: 0;
-      bottom: 0;
-      width: 100vw;
-      background-color: #1f1f1f;
-      color: white;
-      text-align: center;
-      padding: 10px 0;
+
+    SensorSnapshot readings[PUBLISH_BATCH_SAMPLES];
+    size_t count = sleepBatch.size();
+    for (size_t i = 0; i < count; i++) {
+        readings[i] = sleepBatch[i];
     }
-    footer a {
-      color: white;
-      text-decoration: none;
+    bool published = publishBatch(readings, count) == count;
+
+    // Let the client flush the message (or, with QoS 1, wait for the broker
+    // to acknowledge it) before the radio goes off
+    published = published && flushMqtt(LOW_POWER_CONNECT_TIMEOUT_MS);
+    disconnectMqtt();
+    return published;
+}
+
+// One wake-up of the low-power mode. Never returns.
+void runLowPowerCycle() {
+    bool coldBoot =
+        esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED;
+
+    beginSensors();
+    if (coldBoot) {
+        delay(DHT_POWER_UP_DELAY_MS);
+        // Set the clock once, it keeps running during deep sleep
+        configTime(0, 0, "pool.ntp.org");
     }
-    footer a:hover {
-      color: #ddd;
+
+    // Read every sensor. When earlier uploads failed, make room by dropping
+    // the oldest readings
+    for (size_t i = 0; i < sensorCount(); i++) {
+        SensorSnapshot reading;
+        if (!takeReading(i, reading)) {
+            continue;
+        }
+        if (sleepBatch.full()) {
+            sleepBatch.pop();
+        }
+        sleepBatch.push(reading);
     }
-  </style>
-</head>
-<body>
-  <div class="header"><img src="https://i.imgur.com/23DiEOf.png"><h2>ESP32</h2></div>
-  <p>
-    <i class="fa fa-temperature-high" style="color:#9e0505;"></i> 
-    <span class="dht-labels">  TEMPERATURE</span> 
-    <span id="temperature">%TEMPERATURE%</span>
-    <span class="units">&deg;C</span>
-  </p>
-  <p>
-    <i class="fas fa-tint" style="color:#00add6;"></i> 
-    <span class="dht-labels">  HUMIDITY</span>
-    <span id="humidity">%HUMIDITY%</span>
-    <span class="units">&percnt;</span>
-  </p>
-  <footer>
-    <a href="https://github.com/joaoalexarruda" target="_blank"><i class="fab fa-github fa-2x"></i></a>
-  </footer>
-</body>
-<script>
-setInterval(function ( ) {
-  var xhttp = new XMLHttpRequest();
-  xhttp.onreadystatechange = function() {
-    if (this.readyState == 4 && this.status == 200) {
-      document.getElementById("temperature").innerHTML = this.responseText;
+
+    // Publish right away after a cold boot, so the node shows up
+    // (and SNTP gets a chance to set the clock) without waiting a full batch
+    if (sleepBatch.full() || coldBoot) {
+        if (publishSleepBatch()) {
+            sleepBatch.clear();
+        }
+        WiFi.disconnect(true);
     }
-  };
-  xhttp.open("GET", "/temperature", true);
-  xhttp.send();
-}, 10000 ) ;
-
-setInterval(function ( ) {
-  var xhttp = new XMLHttpRequest();
-  xhttp.onreadystatechange = function() {
-    if (this.readyState == 4 && this.status == 200) {
-      document.getElementById("humidity").innerHTML = this.responseText;
+
+    // Sleep for the rest of the interval
+    uint64_t awakeMs = millis();
+    uint64_t sleepMs = awakeMs < LOW_POWER_SAMPLE_INTERVAL_MS
+                           ? LOW_POWER_SAMPLE_INTERVAL_MS - awakeMs
+                           : 0;
+    esp_sleep_enable_timer_wakeup(sleepMs * 1000);
+    esp_deep_sleep_start();
+}
+#endif
+
+// One round of the network task
+void networkRound() {
+    PROFILE_SCOPE(PROFILE_LOOP);
+    uint32_t loopStart = micros();
+
+    // Keep the Wi-Fi link and the connection to the MQTT broker alive,
+    // without blocking
+    maintainWifi();
+    maintainMqtt();
+    maintainOta();
+    maintainProfiler();
+
+    // The sampling task reads every sensor once per SAMPLE_INTERVAL_MS and
+    // publishes a new snapshot with its moving averages. Whenever a new one
+    // shows up, push it to the open web pages; they only want the latest.
+    for (size_t i = 0; i < sensorCount(); i++) {
+        SensorSnapshot snapshot;
+        uint32_t generation = readSnapshot(i, snapshot);
+        if (generation == lastSentGenerations[i]) {
+            continue;
+        }
+
+        // A reading that does not encode is skipped, not sent truncated
+        char eventPayload[MAX_PAYLOAD_SIZE];
+        if (encodeReadingJson(snapshot, eventPayload, sizeof(eventPayload)) >
+            0) {
+            events.send(eventPayload, "reading", generation);
+        }
+        lastSentGenerations[i] = generation;
+    }
+
+    // The aggregation task has already recorded every snapshot in the
+    // history and the rollups; the ones outside the deadband of the last
+    // published reading go to the publish queue
+    SensorSnapshot report;
+    while (takeReport(report)) {
+        enqueueReading(report);
+    }
+
+    // Publish the queued readings, in rate-limited rounds. While the broker
+    // is unreachable they pile up in RAM and then in flash. With QoS 1, no
+    // more readings are taken than the in-flight window has room for.
+    RuntimeConfig config = runtimeConfig();
+    size_t capacity = mqttPublishCapacity();
+    if (mqttConnected() && capacity > 0 && publishDue(config)) {
+        size_t maxReadings = config.batchSamples > 1 ? config.batchSamples
+                                                     : DRAIN_BATCH_SIZE;
+        if (config.batchSamples <= 1) {
+            // The legacy format needs a message per metric
+            size_t messagesPerReading =
+                PAYLOAD_FORMAT == PAYLOAD_LEGACY ? 2 : 1;
+            maxReadings = min(maxReadings, capacity / messagesPerReading);
+        }
+        if (maxReadings > 0) {
+            drainPublishQueue(publishReadings, maxReadings);
+        }
+    }
+
+    // Rollups of the buckets that are over, in the room the readings left
+    capacity = mqttPublishCapacity();
+    if (mqttConnected() && capacity > 0) {
+        drainRollups(publishRollup, min(capacity, DRAIN_BATCH_SIZE));
     }
-  };
-  xhttp.open("GET", "/humidity", true);
-  xhttp.send();
-}, 10000 ) ;
-</script>
-</html>)rawliteral";
-
-// Function to replace the placeholders in the HTML code
-// with the actual values
-String processor(const String &var) {
-    // Serial.println(var);
-    if (var == "TEMPERATURE") {
-        return String(readTemperatureAndCalculateMovingAverage());
-    } else if (var == "HUMIDITY") {
-        return String(readHumidityAndCalculateMovingAverage());
+
+    metrics.loopDuration.observe(micros() - loopStart);
+}
+
+// Body of the network task: a round, then sleep until a reading is queued
+// or NETWORK_TASK_PERIOD_MS went by. Sleeping lets the lower priority tasks
+// of the network core (and its idle task, watched by the watchdog) run.
+void networkTask(void *parameter) {
+    for (;;) {
+        networkRound();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NETWORK_TASK_PERIOD_MS));
     }
-    return String();
 }
 
 // Setup function
 // This function is called only once when the microcontroller starts
 void setup() {
     Serial.begin(115200);                    // Initialize serial communication
-    dht.begin();                             // Initialize DHT sensor
+#ifdef LOW_POWER_MODE
+    runLowPowerCycle();                      // Read, maybe publish, sleep
+#endif
+    startLogger();                           // Write logs from a background task
+    loadRuntimeConfig();                     // Settings saved in NVS, if any
+    startSamplingTask();                     // Start reading the DHT sensor
     setupWifi();                             // Setup Wi-Fi connection
-    client.setServer(mqttServer, mqttPort);  // Setup MQTT broker
+    setupDiscovery();                        // Advertise it over mDNS
+    // Setup MQTT broker; the connection is paused without Wi-Fi
+    beginMqtt(mqttServer, mqttPort, "ESP32Client", onMqttConnect,
+              onMqttMessage);
+    configTime(0, 0, "pool.ntp.org");  // Timestamps for the queued readings
+    setupPublishQueue();               // Restore readings not yet published
+    setupHistory();                    // Open the history kept in flash
+    setupRollupStore();                // and its hourly rollups
 
     // Setup the web server, and define the routes
+    // The page is static: browsers revalidate it with its ETag and get a
+    // 304 as long as the firmware has not changed
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-        request->send_P(200, "text/html", index_html, processor);
+        countMetric(metrics.httpRequests[ROUTE_INDEX]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_INDEX);
+        AsyncWebServerResponse *response;
+        if (request->hasHeader("If-None-Match") &&
+            request->getHeader("If-None-Match")->value() == INDEX_HTML_ETAG) {
+            response = request->beginResponse(304);
+        } else {
+            response = request->beginResponse_P(200, "text/html", INDEX_HTML_GZ,
+                                                INDEX_HTML_GZ_LEN);
+            response->addHeader("Content-Encoding", "gzip");
+        }
+        response->addHeader("ETag", INDEX_HTML_ETAG);
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
     });
+    // The handlers only read the latest snapshot, they never touch the sensor
     server.on("/temperature", HTTP_GET, [](AsyncWebServerRequest *request) {
-        request->send_P(
-            200, "text/plain",
-            String(readTemperatureAndCalculateMovingAverage()).c_str());
+        countMetric(metrics.httpRequests[ROUTE_TEMPERATURE]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_TEMPERATURE);
+        SensorSnapshot snapshot = {};
+        readSnapshot(snapshot);
+        request->send_P(200, "text/plain",
+                        String(snapshot.avgTemperature).c_str());
     });
     server.on("/humidity", HTTP_GET, [](AsyncWebServerRequest *request) {
-        request->send_P(
-            200, "text/plain",
-            String(readHumidityAndCalculateMovingAverage()).c_str());
+        countMetric(metrics.httpRequests[ROUTE_HUMIDITY]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_HUMIDITY);
+        SensorSnapshot snapshot = {};
+        readSnapshot(snapshot);
+        request->send_P(200, "text/plain",
+                        String(snapshot.avgHumidity).c_str());
+    });
+
+    // Latest snapshot as one JSON document. It is formatted into a stack
+    // buffer and written to the response stream, with no String temporaries.
+    // The first sensor by default, another one with ?sensor=<index>
+    server.on("/api/readings", HTTP_GET, [](AsyncWebServerRequest *request) {
+        countMetric(metrics.httpRequests[ROUTE_API_READINGS]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_API_READINGS);
+        size_t sensorIndex = 0;
+        if (request->hasParam("sensor")) {
+            sensorIndex = request->getParam("sensor")->value().toInt();
+            if (sensorIndex >= sensorCount()) {
+                request->send(404, "application/json",
+                              "{\"error\":\"unknown sensor\"}");
+                return;
+            }
+        }
+
+        SensorSnapshot snapshot;
+        if (readSnapshot(sensorIndex, snapshot) == 0) {
+            request->send(503, "application/json",
+                          "{\"error\":\"no reading yet\"}");
+            return;
+        }
+
+        char body[256];
+        size_t length = encodeReadingDetailsJson(
+            snapshot, millis() - snapshot.timestamp, body, sizeof(body));
+        AsyncResponseStream *response =
+            request->beginResponseStream("application/json", sizeof(body));
+        response->write(reinterpret_cast<const uint8_t *>(body), length);
+        request->send(response);
+    });
+
+    // Downsampled history, streamed from flash
+    setupHistoryApi(server);
+
+    // Firmware uploads, streamed to flash (only with OTA_PASSWORD set)
+    setupWebOta(server);
+
+    // Firmware performance metrics, in the Prometheus text format
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        countMetric(metrics.httpRequests[ROUTE_METRICS]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_METRICS);
+        AsyncResponseStream *response = request->beginResponseStream(
+            "text/plain; version=0.0.4; charset=utf-8");
+        writeMetrics(*response);
+        request->send(response);
     });
 
+    // Send the latest reading of every sensor as soon as a page connects,
+    // instead of waiting for the next one
+    events.onConnect([](AsyncEventSourceClient *eventClient) {
+        countMetric(metrics.httpRequests[ROUTE_EVENTS]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_EVENTS);
+        for (size_t i = 0; i < sensorCount(); i++) {
+            SensorSnapshot snapshot;
+            uint32_t generation = readSnapshot(i, snapshot);
+            char payload[MAX_PAYLOAD_SIZE];
+            if (generation != 0 &&
+                encodeReadingJson(snapshot, payload, sizeof(payload)) > 0) {
+                eventClient->send(payload, "reading", generation);
+            }
+        }
+    });
+    server.addHandler(&events);
+
     // Start server
     server.begin();
+
+    // Hand over to the tasks of task_layout.h, the network task first so
+    // the aggregation task can wake it up
+    xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK_SIZE,
+                            nullptr, NETWORK_TASK_PRIORITY, &networkTaskHandle,
+                            NETWORK_TASK_CORE);
+    startAggregationTask(networkTaskHandle);
 }
 
 // Loop function
-// This function is called repeatedly
+// Everything runs in the tasks started by setup(), so the Arduino loop
+// task has nothing left to do and ends itself
 void loop() {
-    // Check if the client is connected to the MQTT broker
-    if (!client.connected()) {
-        reconnect();
-    }
-
-    // Every 3 seconds, read the temperature and humidity from the DHT11 sensor,
-    // calculate the moving average, and publish the values to the MQTT broker
-    // This interval allows the microcontroller to perform other tasks
-    // and not be constantly occupied with reading sensor data.
-    unsigned long currentMillis = millis();
-    if (currentMillis - lastReadingTime >= 3000) {
-        // Read the temperature and humidity from the DHT11 sensor and
-        // calculate the moving average
-        float avgTemperature = readTemperatureAndCalculateMovingAverage();
-        float avgHumidity = readHumidityAndCalculateMovingAverage();
-
-        // Convert the float values to strings
-        char avgTempStr[8];
-        dtostrf(avgTemperature, 2, 2, avgTempStr);
-        char avgHumStr[8];
-        dtostrf(avgHumidity, 2, 2, avgHumStr);
-
-        // Name of the topics to publish the values
-        char avgTempTopic[] = "esp32/moving_average_temperature";
-        char avgHumTopic[] = "esp32/moving_average_humidity";
-
-        // Publish the values to the MQTT broker
-        client.publish(avgTempTopic, avgTempStr);
-        client.publish(avgHumTopic, avgHumStr);
-
-        // Print the values and topics to the serial monitor for debugging
-        Serial.println();
-        Serial.println("+~~~~~~~~~~~~~~~~~~~+~~~~~~~~~~~~~~~~~~~+");
-        Serial.println("|               DEBUGGING               |");
-        Serial.println("+~~~~~~~~~~~~~~~~~~~+~~~~~~~~~~~~~~~~>~~~+");
-        Serial.printf("| Local IP Address  | %-17s |\n",
-                      WiFi.localIP().toString().c_str());
-        Serial.println("+~~~~~~~~~~~~~~~~~~~+~~~~~~~~~~~~~~~~~~~+");
-        Serial.println("| Parameter         | Value             |");
-        Serial.println("+-------------------+-------------------+");
-        Serial.printf("| Moving Avg Temp.  | %-17.2f |\n", avgTemperature);
-        Serial.printf("| Moving Avg Humid. | %-17.2f |\n", avgHumidity);
-        Serial.println("+-------------------+-------------------+");
-        Serial.println("|            Published Topic            |");
-        Serial.println("+-------------------+-------------------+");
-        Serial.println("| " + String(avgTempTopic) + "      |");
-        Serial.println("| " + String(avgHumTopic) + "         |");
-        Serial.println("+-------------------+-------------------+");
-
-        // Update the last reading time
-        lastReadingTime = currentMillis;
-    }
-}
\ No newline at end of file
+    vTaskDelete(nullptr);
+}
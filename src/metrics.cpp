@@ -0,0 +1,104 @@
+/*
+ * File: metrics.cpp
+ * Description: Storage of the firmware metrics and their export in the
+ *              Prometheus text exposition format.
+ */
+
+#include "metrics.h"
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+Metrics metrics;
+
+const char *HTTP_ROUTE_NAMES[ROUTE_COUNT] = {
+    "/",       "/temperature", "/humidity", "/api/readings", "/api/history",
+    "/events", "/metrics",     "/update"};
+
+template <size_t N>
+void Histogram<N>::write(Print &out, const char *name,
+                         const char *labels) const {
+    const char *separator = labels[0] != '\0' ? "," : "";
+
+    // Prometheus buckets are cumulative
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < N; i++) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        out.printf("%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, separator,
+                   bounds[i] / 1e6, cumulative);
+    }
+    uint32_t total = count.load(std::memory_order_relaxed);
+    out.printf("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, separator,
+               total);
+    out.printf("%s_sum{%s} %g\n", name, labels,
+               sumUs.load(std::memory_order_relaxed) / 1e6);
+    out.printf("%s_count{%s} %u\n", name, labels, total);
+}
+
+// Write the HELP and TYPE lines of a metric
+void writeHeader(Print &out, const char *name, const char *type,
+                 const char *help) {
+    out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void writeCounter(Print &out, const char *name, const char *help,
+                  const std::atomic<uint32_t> &counter) {
+    writeHeader(out, name, "counter", help);
+    out.printf("%s %u\n", name, counter.load(std::memory_order_relaxed));
+}
+
+void writeMetrics(Print &out) {
+    writeHeader(out, "dht_read_duration_seconds", "histogram",
+                "Duration of a DHT sensor read.");
+    metrics.dhtReadDuration.write(out, "dht_read_duration_seconds");
+    writeCounter(out, "dht_read_failures_total",
+                 "DHT sensor transactions that failed.",
+                 metrics.dhtReadFailures);
+    writeCounter(out, "sensor_spikes_rejected_total",
+                 "Sensor samples dropped as spikes.", metrics.spikesRejected);
+
+    writeHeader(out, "mqtt_publish_duration_seconds", "histogram",
+                "Duration of an MQTT publish call.");
+    metrics.mqttPublishDuration.write(out, "mqtt_publish_duration_seconds");
+    writeHeader(out, "mqtt_publish_total", "counter",
+                "MQTT publish calls, by result.");
+    out.printf("mqtt_publish_total{result=\"success\"} %u\n",
+               metrics.mqttPublishSuccesses.load(std::memory_order_relaxed));
+    out.printf("mqtt_publish_total{result=\"failure\"} %u\n",
+               metrics.mqttPublishFailures.load(std::memory_order_relaxed));
+    writeCounter(out, "mqtt_reconnect_attempts_total",
+                 "Attempts to connect to the MQTT broker.",
+                 metrics.mqttReconnectAttempts);
+
+    writeHeader(out, "http_requests_total", "counter",
+                "HTTP requests, by route.");
+    for (int route = 0; route < ROUTE_COUNT; route++) {
+        out.printf("http_requests_total{route=\"%s\"} %u\n",
+                   HTTP_ROUTE_NAMES[route],
+                   metrics.httpRequests[route].load(std::memory_order_relaxed));
+    }
+
+    writeHeader(out, "loop_duration_seconds", "histogram",
+                "Duration of one round of the network task.");
+    metrics.loopDuration.write(out, "loop_duration_seconds");
+
+    writeHeader(out, "task_queue_dropped_total", "counter",
+                "Elements dropped by a full queue between two tasks.");
+    out.printf("task_queue_dropped_total{queue=\"samples\"} %u\n",
+               metrics.samplesDropped.load(std::memory_order_relaxed));
+    out.printf("task_queue_dropped_total{queue=\"reports\"} %u\n",
+               metrics.reportsDropped.load(std::memory_order_relaxed));
+    out.printf("task_queue_dropped_total{queue=\"rollups\"} %u\n",
+               metrics.rollupsDropped.load(std::memory_order_relaxed));
+    writeCounter(out, "publish_queue_unsynced_dropped_total",
+                 "Readings without a Unix time dropped instead of spilling "
+                 "to flash.",
+                 metrics.unsyncedDropped);
+
+    writeHeader(out, "heap_free_bytes", "gauge", "Free heap.");
+    out.printf("heap_free_bytes %u\n", ESP.getFreeHeap());
+    writeHeader(out, "heap_largest_free_block_bytes", "gauge",
+                "Largest block that can be allocated from the heap.");
+    out.printf("heap_largest_free_block_bytes %u\n",
+               heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
@@ -0,0 +1,585 @@
+/*
+ * File: mqtt_connection.cpp
+ * Description: Connection to the MQTT broker, through PubSubClient (QoS 0)
+ *              or AsyncMqttClient (QoS 1, with an in-flight window).
+ */
+
+#include "mqtt_connection.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include <ESPmDNS.h>
+#include <WiFi.h>
+
+#include "backoff.h"
+#include "discovery.h"
+#include "log.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "task_layout.h"
+#include "wifi_connection.h"
+
+#include <atomic>
+
+#if MQTT_QOS == 0
+#include <PubSubClient.h>
+#else
+#include <AsyncMqttClient.h>
+
+#include "fixed_queue.h"
+#endif
+
+// States of the connection to the MQTT broker
+enum MqttState {
+    MQTT_DISCONNECTED,  // Ready to try to connect
+    MQTT_RESOLVING,     // Waiting for the address of the broker
+    MQTT_CONNECTING,    // Waiting for the outcome of an attempt
+    MQTT_WAITING,       // Waiting for the backoff delay to expire
+    MQTT_CONNECTED
+};
+
+MqttState mqttState = MQTT_DISCONNECTED;
+Backoff mqttBackoff(MQTT_RETRY_BASE_MS, MQTT_RETRY_MAX_MS);
+unsigned long mqttStateSince = 0;
+uint32_t mqttRetryDelay = 0;
+
+const char *mqttHost = nullptr;
+uint16_t mqttPort = 0;
+const char *mqttClientId = nullptr;
+MqttConnectHandler connectHandler = nullptr;
+MqttMessageHandler messageHandler = nullptr;
+
+// In low-power mode the resolved address lives in RTC memory, so it
+// survives the deep sleeps between readings (but not a reset)
+#ifdef LOW_POWER_MODE
+#define SLEEP_PERSISTENT RTC_DATA_ATTR
+#else
+#define SLEEP_PERSISTENT
+#endif
+
+// Address of the broker, 0 until resolved, and the failed connection
+// attempts to it in a row
+SLEEP_PERSISTENT uint32_t brokerAddress = 0;
+SLEEP_PERSISTENT uint32_t brokerFailures = 0;
+
+// Lookup of the broker name by the resolver task. The task stores the
+// address (0 if not found) before it sets LOOKUP_DONE.
+enum LookupState { LOOKUP_IDLE, LOOKUP_RUNNING, LOOKUP_DONE };
+std::atomic<int> lookupState{LOOKUP_IDLE};
+std::atomic<uint32_t> lookupResult{0};
+
+// Outcome of resolveBroker()
+enum BrokerLookup { BROKER_FOUND, BROKER_PENDING, BROKER_NOT_FOUND };
+
+#if MQTT_QOS == 0
+// PubSubClient backend. Everything runs in the caller's task: connect()
+// blocks until the TCP connection and the CONNACK succeed or time out, and
+// maintainMqtt() reads incoming packets.
+
+WiFiClient mqttWifiClient;
+PubSubClient client(mqttWifiClient);
+
+void onClientMessage(char *topic, uint8_t *payload, unsigned int length) {
+    if (messageHandler != nullptr) {
+        messageHandler(topic, payload, length);
+    }
+}
+
+void setupClient() {
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    client.setCallback(onClientMessage);
+    // Room for the largest message plus the MQTT header and topic
+    size_t largest = MQTT_MAX_MESSAGE_SIZE > MQTT_MAX_INBOUND_SIZE
+                         ? MQTT_MAX_MESSAGE_SIZE
+                         : MQTT_MAX_INBOUND_SIZE;
+    client.setBufferSize(largest + MQTT_MAX_TOPIC_SIZE);
+}
+
+void setClientServer(IPAddress address, uint16_t port) {
+    client.setServer(address, port);
+}
+
+void startConnect() {
+    client.connect(mqttClientId);
+}
+
+bool clientConnected() {
+    return client.connected();
+}
+
+// connect() is synchronous: if it did not succeed, it failed
+bool connectFailed() {
+    return !client.connected();
+}
+
+int clientError() {
+    return client.state();
+}
+
+void serviceClient() {
+    client.loop();
+}
+
+void onClientConnected() {}
+
+bool sendMessage(const char *topic, const uint8_t *payload, size_t length) {
+    return client.publish(topic, payload, length);
+}
+
+size_t inFlightCount() {
+    return 0;
+}
+
+size_t freeSlots() {
+    return SIZE_MAX;
+}
+
+bool clientSubscribe(const char *topic) {
+    return client.subscribe(topic);
+}
+
+void clientDisconnect() {
+    client.disconnect();
+}
+
+#else
+// AsyncMqttClient backend. The client runs in the AsyncTCP task and calls
+// back from there; the callbacks only record what happened, and
+// serviceClient() acts on it from the caller's task.
+
+AsyncMqttClient client;
+
+// Outcome of the last connection attempt, set by the callbacks
+std::atomic<bool> disconnectedEvent{false};
+std::atomic<int> disconnectReason{0};
+
+// A message of the in-flight window, kept until its PUBACK arrives.
+// packetId 0 means it still has to be (re)sent.
+struct InFlightMessage {
+    bool used;
+    uint16_t packetId;
+    char topic[MQTT_MAX_TOPIC_SIZE];
+    uint8_t payload[MQTT_MAX_MESSAGE_SIZE];
+    size_t length;
+};
+
+InFlightMessage inFlight[MQTT_INFLIGHT_WINDOW] = {};
+
+// A message received from the broker, waiting to be handed to the handler
+struct InboundMessage {
+    char topic[MQTT_MAX_TOPIC_SIZE];
+    uint8_t payload[MQTT_MAX_INBOUND_SIZE];
+    size_t length;
+};
+
+// Filled by the callbacks, emptied by serviceClient()
+portMUX_TYPE mqttEventLock = portMUX_INITIALIZER_UNLOCKED;
+FixedQueue<uint16_t, 2 * MQTT_INFLIGHT_WINDOW> acknowledgedPackets;
+FixedQueue<InboundMessage, 4> inboundMessages;
+
+// Large messages may arrive in several chunks; they are put together here
+InboundMessage partialMessage = {};
+
+void onClientDisconnect(AsyncMqttClientDisconnectReason reason) {
+    disconnectReason = static_cast<int>(reason);
+    disconnectedEvent = true;
+}
+
+void onClientPublish(uint16_t packetId) {
+    portENTER_CRITICAL(&mqttEventLock);
+    acknowledgedPackets.push(packetId);
+    portEXIT_CRITICAL(&mqttEventLock);
+}
+
+void onClientMessage(char *topic, char *payload,
+                     AsyncMqttClientMessageProperties properties,
+                     size_t length, size_t index, size_t total) {
+    if (total > sizeof(partialMessage.payload) ||
+        strlen(topic) >= sizeof(partialMessage.topic)) {
+        return;  // Too large for any message the firmware expects
+    }
+    if (index == 0) {
+        strcpy(partialMessage.topic, topic);
+    }
+    memcpy(partialMessage.payload + index, payload, length);
+    if (index + length < total) {
+        return;
+    }
+
+    partialMessage.length = total;
+    portENTER_CRITICAL(&mqttEventLock);
+    inboundMessages.push(partialMessage);
+    portEXIT_CRITICAL(&mqttEventLock);
+}
+
+void setupClient() {
+    client.setClientId(mqttClientId);
+    client.onDisconnect(onClientDisconnect);
+    client.onPublish(onClientPublish);
+    client.onMessage(onClientMessage);
+}
+
+void setClientServer(IPAddress address, uint16_t port) {
+    client.setServer(address, port);
+}
+
+void startConnect() {
+    disconnectedEvent = false;
+    client.connect();
+}
+
+bool clientConnected() {
+    return client.connected();
+}
+
+bool connectFailed() {
+    if (disconnectedEvent ||
+        millis() - mqttStateSince >= MQTT_CONNECT_TIMEOUT_MS) {
+        client.disconnect(true);
+        return true;
+    }
+    return false;
+}
+
+int clientError() {
+    return disconnectReason;
+}
+
+// Send an in-flight message, or send it again after a reconnection
+void sendInFlight(InFlightMessage &message, bool resend) {
+    const char *payload = reinterpret_cast<const char *>(message.payload);
+    message.packetId = client.publish(message.topic, 1, false, payload,
+                                      message.length, resend);
+}
+
+void serviceClient() {
+    // Free the slots of the acknowledged messages
+    for (;;) {
+        portENTER_CRITICAL(&mqttEventLock);
+        bool empty = acknowledgedPackets.empty();
+        uint16_t packetId = empty ? 0 : acknowledgedPackets.front();
+        if (!empty) {
+            acknowledgedPackets.pop();
+        }
+        portEXIT_CRITICAL(&mqttEventLock);
+        if (empty) {
+            break;
+        }
+
+        for (InFlightMessage &message : inFlight) {
+            if (message.used && message.packetId == packetId) {
+                message.used = false;
+                break;
+            }
+        }
+    }
+
+    // Hand over the received messages, one copy at a time
+    for (;;) {
+        InboundMessage message;
+        portENTER_CRITICAL(&mqttEventLock);
+        bool empty = inboundMessages.empty();
+        if (!empty) {
+            message = inboundMessages.front();
+            inboundMessages.pop();
+        }
+        portEXIT_CRITICAL(&mqttEventLock);
+        if (empty) {
+            break;
+        }
+
+        if (messageHandler != nullptr) {
+            messageHandler(message.topic, message.payload, message.length);
+        }
+    }
+
+    // Retry the messages the client could not take earlier
+    if (client.connected()) {
+        for (InFlightMessage &message : inFlight) {
+            if (message.used && message.packetId == 0) {
+                sendInFlight(message, true);
+            }
+        }
+    }
+}
+
+// The broker forgets unacknowledged messages with a clean session, so
+// send again every message still in the window
+void onClientConnected() {
+    for (InFlightMessage &message : inFlight) {
+        if (message.used) {
+            sendInFlight(message, true);
+        }
+    }
+}
+
+bool sendMessage(const char *topic, const uint8_t *payload, size_t length) {
+    if (length > MQTT_MAX_MESSAGE_SIZE ||
+        strlen(topic) >= MQTT_MAX_TOPIC_SIZE) {
+        return false;
+    }
+    for (InFlightMessage &message : inFlight) {
+        if (!message.used) {
+            strcpy(message.topic, topic);
+            memcpy(message.payload, payload, length);
+            message.length = length;
+            sendInFlight(message, false);
+            if (message.packetId == 0) {
+                return false;
+            }
+            message.used = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t inFlightCount() {
+    size_t count = 0;
+    for (const InFlightMessage &message : inFlight) {
+        count += message.used;
+    }
+    return count;
+}
+
+size_t freeSlots() {
+    return MQTT_INFLIGHT_WINDOW - inFlightCount();
+}
+
+bool clientSubscribe(const char *topic) {
+    return client.subscribe(topic, 1) != 0;
+}
+
+void clientDisconnect() {
+    client.disconnect(true);
+}
+#endif
+
+bool isMdnsName(const char *host) {
+    size_t length = strlen(host);
+    return length > 6 && strcmp(host + length - 6, ".local") == 0;
+}
+
+// Body of the resolver task. An mDNS name is looked up with a query on the
+// local network, any other name with the DNS servers of the Wi-Fi link.
+// Both block for at most a few seconds.
+void resolverTask(void *parameter) {
+    IPAddress address;
+    if (isMdnsName(mqttHost)) {
+        // The query takes the name without the domain
+        char name[64];
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(mqttHost) - 6),
+                 mqttHost);
+        address = MDNS.queryHost(name, MQTT_MDNS_TIMEOUT_MS);
+    } else if (WiFi.hostByName(mqttHost, address) != 1) {
+        address = IPAddress();
+    }
+    lookupResult = uint32_t(address);
+    lookupState = LOOKUP_DONE;
+    vTaskDelete(nullptr);
+}
+
+// Find the address of the broker, unless it is already known, and give it
+// to the client. A name is looked up by the resolver task, so that the
+// caller never waits for it: BROKER_PENDING until the lookup is over, call
+// again on a later round.
+BrokerLookup resolveBroker() {
+    if (brokerAddress == 0) {
+        IPAddress address;
+        int state = lookupState;
+        if (address.fromString(mqttHost)) {
+            brokerAddress = address;  // Nothing to resolve
+        } else if (state == LOOKUP_RUNNING) {
+            return BROKER_PENDING;
+        } else if (state == LOOKUP_IDLE) {
+            // The responder is started here, not by the resolver task
+            if (isMdnsName(mqttHost) && !beginMdns()) {
+                return BROKER_NOT_FOUND;
+            }
+            lookupState = LOOKUP_RUNNING;
+            if (xTaskCreatePinnedToCore(resolverTask, "resolver",
+                                        RESOLVER_TASK_STACK_SIZE, nullptr,
+                                        RESOLVER_TASK_PRIORITY, nullptr,
+                                        RESOLVER_TASK_CORE) != pdPASS) {
+                lookupState = LOOKUP_IDLE;
+                return BROKER_NOT_FOUND;
+            }
+            return BROKER_PENDING;
+        } else {
+            lookupState = LOOKUP_IDLE;
+            brokerAddress = lookupResult;
+            if (brokerAddress == 0) {
+                return BROKER_NOT_FOUND;
+            }
+            LOG_INFO("MQTT broker %s is at %s", mqttHost,
+                     IPAddress(brokerAddress).toString().c_str());
+        }
+    }
+    setClientServer(IPAddress(brokerAddress), mqttPort);
+    return BROKER_FOUND;
+}
+
+// Count a failed connection attempt, and forget the address of a broker
+// given by name after too many of them, so that it is looked up again
+void brokerAttemptFailed() {
+    brokerFailures++;
+    IPAddress literal;
+    if (brokerFailures >= MQTT_RESOLVE_AFTER_FAILURES &&
+        !literal.fromString(mqttHost)) {
+        brokerAddress = 0;
+        brokerFailures = 0;
+    }
+}
+
+// Wait for the backoff delay before the next attempt
+void waitBeforeRetry() {
+    mqttRetryDelay = mqttBackoff.nextDelay(esp_random());
+    mqttStateSince = millis();
+    mqttState = MQTT_WAITING;
+}
+
+// Called when the Wi-Fi link goes up or down. While the link is down there
+// is no point in trying the broker; once it is back, try right away instead
+// of waiting for the backoff, so the publish queue can drain again.
+void onWifiLinkChange(bool connected) {
+    if (!connected) {
+        clientDisconnect();
+    }
+    mqttBackoff.reset();
+    mqttState = MQTT_DISCONNECTED;
+}
+
+void beginMqtt(const char *host, uint16_t port, const char *clientId,
+               MqttConnectHandler onConnect, MqttMessageHandler onMessage) {
+    mqttHost = host;
+    mqttPort = port;
+    mqttClientId = clientId;
+    connectHandler = onConnect;
+    messageHandler = onMessage;
+    setupClient();
+    onWifiChange(onWifiLinkChange);
+}
+
+void maintainMqtt() {
+    if (!wifiConnected()) {
+        return;
+    }
+
+    serviceClient();
+
+    switch (mqttState) {
+        case MQTT_CONNECTED:
+            if (clientConnected()) {
+                return;
+            }
+            LOG_WARN("Lost connection to MQTT broker");
+            // Try again right away
+            [[fallthrough]];
+
+        case MQTT_DISCONNECTED:
+            LOG_INFO("Trying to connect to MQTT broker...");
+            countMetric(metrics.mqttReconnectAttempts);
+            mqttState = MQTT_RESOLVING;
+            [[fallthrough]];
+
+        case MQTT_RESOLVING:
+            switch (resolveBroker()) {
+                case BROKER_PENDING:
+                    return;
+                case BROKER_NOT_FOUND:
+                    waitBeforeRetry();
+                    LOG_WARN("Could not resolve MQTT broker %s, retrying in "
+                             "%u ms...",
+                             mqttHost, mqttRetryDelay);
+                    return;
+                case BROKER_FOUND:
+                    break;
+            }
+            mqttState = MQTT_CONNECTING;
+            mqttStateSince = millis();
+            startConnect();
+            // PubSubClient already knows the outcome
+            [[fallthrough]];
+
+        case MQTT_CONNECTING:
+            if (clientConnected()) {
+                LOG_INFO("Connected to MQTT broker");
+                mqttBackoff.reset();
+                brokerFailures = 0;
+                mqttState = MQTT_CONNECTED;
+                onClientConnected();
+                if (connectHandler != nullptr) {
+                    connectHandler();
+                }
+            } else if (connectFailed()) {
+                brokerAttemptFailed();
+                waitBeforeRetry();
+                LOG_WARN("MQTT connection failed, rc=%d Retrying in %u ms...",
+                         clientError(), mqttRetryDelay);
+            }
+            break;
+
+        case MQTT_WAITING:
+            if (millis() - mqttStateSince >= mqttRetryDelay) {
+                mqttState = MQTT_DISCONNECTED;
+            }
+            break;
+    }
+}
+
+bool connectMqtt(uint32_t timeoutMs) {
+    unsigned long start = millis();
+    do {
+        maintainMqtt();
+        if (mqttState == MQTT_CONNECTED) {
+            return true;
+        }
+        delay(10);
+    } while (millis() - start < timeoutMs);
+    return false;
+}
+
+bool mqttConnected() {
+    return mqttState == MQTT_CONNECTED;
+}
+
+bool mqttSubscribe(const char *topic) {
+    return clientSubscribe(topic);
+}
+
+bool mqttPublish(const char *topic, const uint8_t *payload, size_t length) {
+    PROFILE_SCOPE(PROFILE_MQTT_PUBLISH);
+    uint32_t publishStart = micros();
+    bool published = sendMessage(topic, payload, length);
+    metrics.mqttPublishDuration.observe(micros() - publishStart);
+    countMetric(published ? metrics.mqttPublishSuccesses
+                          : metrics.mqttPublishFailures);
+    return published;
+}
+
+bool mqttPublish(const char *topic, const char *payload) {
+    return mqttPublish(topic, reinterpret_cast<const uint8_t *>(payload),
+                       strlen(payload));
+}
+
+size_t mqttPublishCapacity() {
+    return freeSlots();
+}
+
+bool flushMqtt(uint32_t timeoutMs) {
+    unsigned long start = millis();
+    do {
+        serviceClient();
+        if (inFlightCount() == 0) {
+            return true;
+        }
+        delay(10);
+    } while (millis() - start < timeoutMs);
+    return false;
+}
+
+void disconnectMqtt() {
+    clientDisconnect();
+    mqttState = MQTT_DISCONNECTED;
+}
@@ -0,0 +1,177 @@
+/*
+ * File: native_bench.cpp
+ * Description: Host benchmark of the hardware-independent code in
+ *              lib/sensor_core, built by env:native only. It reports the
+ *              time per sample of every reading filter, payload encoder
+ *              and the history codec, and the heap each one used, which
+ *              must stay at zero: the exit status is 1 otherwise.
+ *
+ *              pio run -e native -t exec
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <new>
+
+#include "history_codec.h"
+#include "payload.h"
+#include "rollup.h"
+#include "sample_filter.h"
+#include "spsc_queue.h"
+
+// Window of the mean and median filters, the firmware default
+const size_t BENCH_WINDOW = 10;
+
+// Iterations of each benchmark, and the number of distinct inputs they
+// cycle through
+const size_t BENCH_ITERATIONS = 1000000;
+const size_t BENCH_INPUTS = 1024;
+
+// Unix time of the first input, which are 3 seconds apart
+const uint32_t BENCH_START_EPOCH = 1700000000;
+
+// Heap use, counted by the global operator new
+size_t allocatedBytes = 0;
+
+void *operator new(size_t size) {
+    allocatedBytes += size;
+    void *memory = malloc(size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+// Noisy readings around 21.5 degrees, with a few spikes
+float temperatures[BENCH_INPUTS];
+SensorSnapshot snapshots[BENCH_INPUTS];
+
+// Keeps the compiler from optimizing the measured work away
+volatile float floatSink;
+volatile size_t sizeSink;
+
+bool allocationFree = true;
+
+// Run `body` BENCH_ITERATIONS times and print the time and heap per call
+template <typename Body>
+void bench(const char *name, Body body) {
+    size_t allocatedBefore = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_ITERATIONS; i++) {
+        body(i % BENCH_INPUTS);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() /
+                BENCH_ITERATIONS;
+    size_t allocated = allocatedBytes - allocatedBefore;
+    if (allocated > 0) {
+        allocationFree = false;
+    }
+    printf("%-28s %10.1f ns/sample %10zu bytes allocated\n", name, ns,
+           allocated);
+}
+
+template <typename Filter>
+void benchFilter(const char *name, Filter filter) {
+    bench(name, [&](size_t i) { floatSink = filter.update(temperatures[i]); });
+}
+
+void setupInputs() {
+    srand(1);
+    for (size_t i = 0; i < BENCH_INPUTS; i++) {
+        float noise = (rand() % 21 - 10) / 10.0f;
+        float spike = rand() % 64 == 0 ? 30.0f : 0.0f;
+        temperatures[i] = 21.5f + noise + spike;
+
+        SensorSnapshot &snapshot = snapshots[i];
+        snapshot.avgTemperature = 21.5f + noise / 4;
+        snapshot.avgHumidity = 40.0f - noise;
+        snapshot.rawTemperature = temperatures[i];
+        snapshot.rawHumidity = 40.0f;
+        snapshot.epoch = BENCH_START_EPOCH + 3 * i;
+        snapshot.sampleCount = i;
+        snapshot.sensorOk = true;
+    }
+}
+
+int main() {
+    setupInputs();
+
+    benchFilter("MeanFilter", MeanFilter<float, BENCH_WINDOW>());
+    benchFilter("MedianFilter", MedianFilter<float, BENCH_WINDOW>());
+    benchFilter("EmaFilter", EmaFilter<float>(0.2f));
+    benchFilter("KalmanFilter", KalmanFilter<float>(0.01f, 1.0f));
+
+    SpikeGate<float> gate(5.0f);
+    bench("SpikeGate", [&](size_t i) {
+        if (!gate.isSpike(temperatures[i])) {
+            gate.accept(temperatures[i]);
+        }
+        floatSink = gate.lastAccepted();
+    });
+
+    // One hand-over between two tasks, without the other core
+    SpscQueue<SensorSnapshot, 16> queue;
+    SensorSnapshot taken = {};
+    bench("SpscQueue", [&](size_t i) {
+        queue.push(snapshots[i]);
+        if (queue.pop(taken)) {
+            floatSink = taken.avgTemperature;
+        }
+    });
+
+    Rollup rollup = {};
+    bench("Rollup::add", [&](size_t i) {
+        rollup.add(temperatures[i], 40.0f);
+        floatSink = rollup.sumTemperature;
+    });
+
+    char json[MAX_PAYLOAD_SIZE];
+    uint8_t cbor[MAX_PAYLOAD_SIZE];
+    bench("encodeReadingJson", [&](size_t i) {
+        sizeSink = encodeReadingJson(snapshots[i], json, sizeof(json));
+    });
+    bench("encodeReadingCbor", [&](size_t i) {
+        sizeSink = encodeReadingCbor(snapshots[i], cbor, sizeof(cbor));
+    });
+    bench("encodeRollupJson", [&](size_t) {
+        sizeSink = encodeRollupJson(0, 3600, rollup, json, sizeof(json));
+    });
+    bench("encodeRollupCbor", [&](size_t) {
+        sizeSink = encodeRollupCbor(0, 3600, rollup, cbor, sizeof(cbor));
+    });
+
+    // A history page is started over whenever it is full, as on flash.
+    // The inputs wrap around in time, which exercises the long encodings.
+    uint8_t page[HISTORY_PAGE_DATA_SIZE];
+    size_t written = 0;
+    HistoryCursor first = {};
+    HistoryCursor cursor = {};
+    bench("encodeHistorySample", [&](size_t i) {
+        BitWriter bits(page, sizeof(page), written);
+        int16_t tenths = snapshots[i].avgTemperature * 10;
+        if (!encodeHistorySample(bits, cursor, snapshots[i].epoch, tenths,
+                                 400)) {
+            first = cursor = {snapshots[i].epoch, 0, tenths, 400};
+            bits = BitWriter(page, sizeof(page));
+        }
+        written = bits.bitsWritten();
+    });
+    BitReader reader(page, written);
+    cursor = first;
+    bench("decodeHistorySample", [&](size_t) {
+        if (!decodeHistorySample(reader, cursor)) {
+            reader = BitReader(page, written);
+            cursor = first;
+        }
+        sizeSink = cursor.epoch;
+    });
+
+    return allocationFree ? 0 : 1;
+}
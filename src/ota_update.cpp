@@ -0,0 +1,252 @@
+/*
+ * File: ota_update.cpp
+ * Description: Over-the-air firmware updates through the web server or an
+ *              HTTP pull.
+ */
+
+#include "ota_update.h"
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <ctype.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "history_store.h"
+#include "log.h"
+#include "metrics.h"
+#include "payload.h"
+#include "profiler.h"
+#include "runtime_config.h"
+#include "task_layout.h"
+
+// Only one update may run at a time, whichever way it came in
+std::atomic<bool> otaInProgress{false};
+
+// Set once an image has been written, to restart from the network task
+std::atomic<bool> restartPending{false};
+unsigned long updateFinishedTime = 0;
+
+// Request whose upload is being written, if any
+AsyncWebServerRequest *uploadRequest = nullptr;
+
+void finishUpdate(bool written) {
+    if (written) {
+        LOG_INFO("Firmware update written, restarting");
+        updateFinishedTime = millis();
+        restartPending = true;
+    } else {
+        LOG_ERROR("Firmware update failed: %s", Update.errorString());
+        otaInProgress = false;
+    }
+}
+
+#ifdef OTA_PASSWORD
+// Called by the web server for every chunk of the uploaded file, from the
+// AsyncTCP task. Each chunk goes straight to flash.
+void handleUpload(AsyncWebServerRequest *request, const String &filename,
+                  size_t index, uint8_t *data, size_t length, bool final) {
+    if (index == 0) {
+        if (!request->authenticate(OTA_USERNAME, OTA_PASSWORD) ||
+            otaInProgress.exchange(true)) {
+            return;
+        }
+        LOG_INFO("Receiving firmware update %s", filename.c_str());
+        uploadRequest = request;
+        Update.begin(UPDATE_SIZE_UNKNOWN);
+
+        // Free the updater if the client goes away halfway through
+        request->onDisconnect([request]() {
+            if (uploadRequest == request) {
+                uploadRequest = nullptr;
+                Update.abort();
+                otaInProgress = false;
+            }
+        });
+    }
+    if (request != uploadRequest || Update.hasError()) {
+        return;
+    }
+
+    if (length > 0 && Update.write(data, length) != length) {
+        return;  // Reported once the request is complete
+    }
+    if (final) {
+        finishUpdate(Update.end(true));
+    }
+}
+
+void setupWebOta(AsyncWebServer &server) {
+    // Called once the whole upload has been received
+    auto handleRequest = [](AsyncWebServerRequest *request) {
+        countMetric(metrics.httpRequests[ROUTE_UPDATE]);
+        PROFILE_SCOPE(PROFILE_HTTP_FIRST + ROUTE_UPDATE);
+        if (!request->authenticate(OTA_USERNAME, OTA_PASSWORD)) {
+            request->requestAuthentication();
+            return;
+        }
+        if (request != uploadRequest) {
+            request->send(409, "text/plain", "Update already in progress\n");
+            return;
+        }
+
+        uploadRequest = nullptr;
+        if (restartPending) {
+            request->send(200, "text/plain", "OK, restarting\n");
+        } else {
+            if (!Update.hasError()) {
+                Update.abort();  // The upload ended without its final chunk
+            }
+            otaInProgress = false;
+            request->send(500, "text/plain", Update.errorString());
+        }
+    };
+    server.on("/update", HTTP_POST, handleRequest, handleUpload);
+}
+
+// Details of the pull, kept for the OTA task
+char pullUrl[160];
+char pullMd5[33];
+
+char updateTopic[40] = "";
+
+// Compare without stopping at the first wrong character, so the time
+// taken does not tell how much of the password was right
+bool passwordMatches(const char *password) {
+    size_t length = strlen(OTA_PASSWORD);
+    uint8_t difference = strlen(password) != length;
+    for (size_t i = 0; i < length; i++) {
+        difference |= (uint8_t)(password[i] ^ OTA_PASSWORD[i]);
+        if (password[i] == '\0') {
+            break;
+        }
+    }
+    return difference == 0;
+}
+
+// Download the image and write it chunk by chunk. The server must send a
+// Content-Length, so that a truncated download is detected.
+bool pullFirmware(const char *url, const char *md5) {
+    HTTPClient http;
+    http.setTimeout(OTA_STALL_TIMEOUT_MS);
+    if (!http.begin(url)) {
+        LOG_ERROR("Invalid firmware URL %s", url);
+        return false;
+    }
+    int status = http.GET();
+    int size = http.getSize();
+    if (status != HTTP_CODE_OK || size <= 0) {
+        LOG_ERROR("Firmware download failed, HTTP %d, size %d", status, size);
+        http.end();
+        return false;
+    }
+    if (!Update.begin(size)) {
+        http.end();
+        return false;
+    }
+    Update.setMD5(md5);
+
+    LOG_INFO("Downloading %d bytes of firmware from %s", size, url);
+    static uint8_t chunk[OTA_CHUNK_SIZE];
+    WiFiClient *stream = http.getStreamPtr();
+    size_t written = 0;
+    unsigned long lastData = millis();
+    while (written < (size_t)size && http.connected()) {
+        size_t available = stream->available();
+        if (available == 0) {
+            if (millis() - lastData >= OTA_STALL_TIMEOUT_MS) {
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(2));
+            continue;
+        }
+
+        size_t length = stream->readBytes(
+            chunk, available < sizeof(chunk) ? available : sizeof(chunk));
+        if (Update.write(chunk, length) != length) {
+            break;
+        }
+        written += length;
+        lastData = millis();
+        LOG_EVERY(5000, LOG_INFO("Firmware download: %u of %d bytes",
+                                 (unsigned)written, size));
+    }
+    http.end();
+
+    // Fails unless every byte was written and the MD5 matches
+    return Update.end();
+}
+
+void otaTask(void *parameter) {
+    finishUpdate(pullFirmware(pullUrl, pullMd5));
+    vTaskDelete(nullptr);
+}
+
+bool validMd5(const char *md5) {
+    if (strlen(md5) != 32) {
+        return false;
+    }
+    for (const char *p = md5; *p != '\0'; p++) {
+        if (!isxdigit((unsigned char)*p)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool startHttpOta(const char *json) {
+    char password[64];
+    if (!findJsonString(json, "password", password, sizeof(password)) ||
+        !passwordMatches(password)) {
+        LOG_WARN("Ignoring firmware update without the OTA password");
+        return false;
+    }
+    char url[sizeof(pullUrl)];
+    if (!findJsonString(json, "url", url, sizeof(url)) ||
+        strncmp(url, "http://", 7) != 0) {
+        LOG_WARN("Ignoring firmware update without an http:// URL");
+        return false;
+    }
+    char md5[sizeof(pullMd5)];
+    if (!findJsonString(json, "md5", md5, sizeof(md5)) || !validMd5(md5)) {
+        LOG_WARN("Ignoring firmware update without a valid MD5");
+        return false;
+    }
+
+    if (otaInProgress.exchange(true)) {
+        LOG_WARN("Firmware update already in progress");
+        return false;
+    }
+    strcpy(pullUrl, url);
+    strcpy(pullMd5, md5);
+    xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK_SIZE, nullptr,
+                            OTA_TASK_PRIORITY, nullptr, OTA_TASK_CORE);
+    return true;
+}
+
+const char *otaTopic() {
+    if (updateTopic[0] == '\0') {
+        // Same device part as the config topic, ".../config" -> ".../ota"
+        const char *config = runtimeConfigTopic();
+        size_t prefix = strrchr(config, '/') - config;
+        snprintf(updateTopic, sizeof(updateTopic), "%.*s/ota", (int)prefix,
+                 config);
+    }
+    return updateTopic;
+}
+#else
+void setupWebOta(AsyncWebServer &server) {
+    LOG_INFO("Firmware updates disabled, OTA_PASSWORD is not set");
+}
+#endif
+
+void maintainOta() {
+    if (restartPending &&
+        millis() - updateFinishedTime >= OTA_RESTART_DELAY_MS) {
+        flushHistory();  // Keep the samples of the pages being filled
+        ESP.restart();
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * File: profiler.cpp
+ * Description: Percentile histograms of the profiled scopes, logged
+ *              periodically with the state of the heap.
+ */
+
+#include "profiler.h"
+
+#ifdef PROFILE
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+#include "latency_histogram.h"
+#include "log.h"
+
+// Name of each point in the log, the routes after the fixed ones
+const char *PROFILE_POINT_NAMES[PROFILE_HTTP_FIRST] = {
+    "loop", "sampling", "sample_period", "aggregation", "mqtt_publish"};
+
+LatencyHistogram profileHistograms[PROFILE_POINTS];
+
+unsigned long lastDumpTime = 0;
+
+void profileRecord(int point, uint32_t durationUs) {
+    profileHistograms[point].record(durationUs);
+}
+
+// Log one line per point with samples, then reset it, so each dump
+// covers the last PROFILE_DUMP_INTERVAL_MS only
+void dumpHistograms() {
+    LOG_INFO("profile: %-20s %7s %8s %8s %8s %8s", "point", "count",
+             "p50_us", "p90_us", "p99_us", "max_us");
+    for (int point = 0; point < PROFILE_POINTS; point++) {
+        LatencyHistogram &histogram = profileHistograms[point];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        const char *name =
+            point < PROFILE_HTTP_FIRST
+                ? PROFILE_POINT_NAMES[point]
+                : HTTP_ROUTE_NAMES[point - PROFILE_HTTP_FIRST];
+        LOG_INFO("profile: %-20s %7u %8u %8u %8u %8u", name,
+                 histogram.count(), histogram.percentile(0.5f),
+                 histogram.percentile(0.9f), histogram.percentile(0.99f),
+                 histogram.max());
+        histogram.reset();
+    }
+}
+
+// Free 8-bit heap, its largest block and the fragmentation that follows:
+// the share of the free heap that cannot be had in a single allocation
+void dumpHeap() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    unsigned fragmentation =
+        info.total_free_bytes == 0
+            ? 0
+            : 100 - 100ULL * info.largest_free_block / info.total_free_bytes;
+    LOG_INFO("profile: heap free %u, largest block %u, fragmentation %u%%, "
+             "minimum free %u, %u allocated / %u free blocks",
+             (unsigned)info.total_free_bytes,
+             (unsigned)info.largest_free_block, fragmentation,
+             (unsigned)info.minimum_free_bytes,
+             (unsigned)info.allocated_blocks, (unsigned)info.free_blocks);
+}
+
+void maintainProfiler() {
+    if (millis() - lastDumpTime < PROFILE_DUMP_INTERVAL_MS) {
+        return;
+    }
+    lastDumpTime = millis();
+    dumpHistograms();
+    dumpHeap();
+}
+#endif
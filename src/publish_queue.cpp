@@ -0,0 +1,231 @@
+/*
+ * File: publish_queue.cpp
+ * Description: Implementation of the store-and-forward publish queue.
+ *              The RAM part is a FixedQueue; the flash part is a fixed-size
+ *              ring of records in a single LittleFS file, preceded by a small
+ *              header holding the ring position.
+ */
+
+#include "publish_queue.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <time.h>
+
+#include "fixed_queue.h"
+#include "log.h"
+#include "metrics.h"
+#include "runtime_config.h"
+
+// Path of the overflow ring file
+const char *OUTBOX_PATH = "/outbox.bin";
+
+// Identifies the file layout. Any change to SensorSnapshot changes the
+// record size, which makes an old file be discarded instead of misread.
+const uint32_t OUTBOX_MAGIC = 0x4F555442;  // "OUTB"
+
+struct OutboxHeader {
+    uint32_t magic;
+    uint32_t recordSize;
+    uint32_t head;   // Index of the oldest record in the ring
+    uint32_t count;  // Number of records in the ring
+};
+
+// Readings waiting in RAM. They are always newer than the ones in flash,
+// because only the oldest RAM reading ever overflows to flash.
+FixedQueue<SensorSnapshot, PUBLISH_QUEUE_RAM_CAPACITY> ramQueue;
+
+File outbox;
+OutboxHeader outboxHeader = {};
+bool outboxReady = false;
+
+// Readings gathered for one round of draining
+SensorSnapshot drainBuffer[MAX_DRAIN_READINGS];
+
+unsigned long lastDrainTime = 0;
+
+// Persist the ring position
+void writeOutboxHeader() {
+    outbox.seek(0, SeekSet);
+    outbox.write(reinterpret_cast<const uint8_t *>(&outboxHeader),
+                 sizeof(outboxHeader));
+    outbox.flush();
+}
+
+// Position of the i-th record of the ring in the file
+size_t outboxOffset(uint32_t index) {
+    return sizeof(OutboxHeader) +
+           (index % PUBLISH_QUEUE_FLASH_CAPACITY) * sizeof(SensorSnapshot);
+}
+
+// Readings taken before SNTP set the clock have no Unix time. As long as
+// they are still in RAM (i.e. from this boot), it can be derived from
+// millis(); a reading in flash always has one, see spillToFlash()
+void resolveEpoch(SensorSnapshot &reading) {
+    time_t now = time(nullptr);
+    if (reading.epoch == 0 && now >= MIN_VALID_EPOCH) {
+        reading.epoch = now - (millis() - reading.timestamp) / 1000;
+    }
+}
+
+// Remove the oldest record of the flash ring (only in RAM, the caller
+// decides when to persist the header)
+void dropOldestFromFlash() {
+    outboxHeader.head = (outboxHeader.head + 1) % PUBLISH_QUEUE_FLASH_CAPACITY;
+    outboxHeader.count--;
+}
+
+// Append a reading to the flash ring, dropping the oldest one if it is full.
+// A reading whose time is still unknown is dropped instead: its millis()
+// timestamp would mean nothing after a reboot, and it would be backfilled
+// without a time.
+void spillToFlash(SensorSnapshot reading) {
+    if (!outboxReady) {
+        return;  // No flash available: the reading is lost
+    }
+    resolveEpoch(reading);
+    if (reading.epoch == 0) {
+        countMetric(metrics.unsyncedDropped);
+        LOG_EVERY(60000, LOG_WARN("Clock not set, dropping a reading "
+                                  "instead of keeping it in flash"));
+        return;
+    }
+
+    if (outboxHeader.count == PUBLISH_QUEUE_FLASH_CAPACITY) {
+        dropOldestFromFlash();
+    }
+
+    outbox.seek(outboxOffset(outboxHeader.head + outboxHeader.count), SeekSet);
+    outbox.write(reinterpret_cast<const uint8_t *>(&reading), sizeof(reading));
+    outboxHeader.count++;
+    writeOutboxHeader();
+}
+
+// Read the i-th oldest reading of the flash ring, without removing it
+bool peekFlash(uint32_t i, SensorSnapshot &reading) {
+    if (!outboxReady || i >= outboxHeader.count) {
+        return false;
+    }
+    outbox.seek(outboxOffset(outboxHeader.head + i), SeekSet);
+    return outbox.read(reinterpret_cast<uint8_t *>(&reading),
+                       sizeof(reading)) == sizeof(reading);
+}
+
+void setupPublishQueue() {
+    // Format the partition on the first boot
+    if (!LittleFS.begin(true)) {
+        LOG_ERROR("Failed to mount LittleFS, no flash overflow");
+        return;
+    }
+
+    if (!LittleFS.exists(OUTBOX_PATH)) {
+        File created = LittleFS.open(OUTBOX_PATH, "w");
+        created.close();
+    }
+
+    outbox = LittleFS.open(OUTBOX_PATH, "r+");
+    if (!outbox) {
+        LOG_ERROR("Failed to open the publish queue file");
+        return;
+    }
+    outboxReady = true;
+
+    // Start over if the file is new or was written by another layout
+    bool valid = outbox.read(reinterpret_cast<uint8_t *>(&outboxHeader),
+                             sizeof(outboxHeader)) == sizeof(outboxHeader) &&
+                 outboxHeader.magic == OUTBOX_MAGIC &&
+                 outboxHeader.recordSize == sizeof(SensorSnapshot) &&
+                 outboxHeader.count <= PUBLISH_QUEUE_FLASH_CAPACITY;
+    if (!valid) {
+        outboxHeader = {OUTBOX_MAGIC, sizeof(SensorSnapshot), 0, 0};
+        writeOutboxHeader();
+    }
+
+    if (outboxHeader.count > 0) {
+        LOG_INFO("%u readings restored from flash", outboxHeader.count);
+    }
+}
+
+void enqueueReading(const SensorSnapshot &reading) {
+    if (ramQueue.full()) {
+        spillToFlash(ramQueue.front());
+        ramQueue.pop();
+    }
+    ramQueue.push(reading);
+}
+
+size_t drainPublishQueue(ReadingPublisher publish, size_t maxReadings) {
+    unsigned long currentMillis = millis();
+    if (currentMillis - lastDrainTime < DRAIN_INTERVAL_MS) {
+        return 0;
+    }
+    lastDrainTime = currentMillis;
+
+    if (maxReadings > MAX_DRAIN_READINGS) {
+        maxReadings = MAX_DRAIN_READINGS;
+    }
+
+    // Gather the oldest readings: first the ones in flash, then the RAM ones.
+    // Records without a Unix time, left by an older firmware, are dropped
+    // once they reach the head; until then the round stops before them.
+    size_t fromFlash = 0;
+    size_t count = 0;
+    bool headDropped = false;
+    bool untimed = false;
+    while (count < maxReadings && peekFlash(fromFlash, drainBuffer[count])) {
+        if (drainBuffer[count].epoch == 0) {
+            if (fromFlash > 0) {
+                untimed = true;
+                break;
+            }
+            dropOldestFromFlash();
+            countMetric(metrics.unsyncedDropped);
+            headDropped = true;
+            continue;
+        }
+        fromFlash++;
+        count++;
+    }
+    for (size_t i = 0; !untimed && count < maxReadings && i < ramQueue.size();
+         i++) {
+        drainBuffer[count] = ramQueue[i];
+        resolveEpoch(drainBuffer[count]);
+        count++;
+    }
+    if (headDropped) {
+        writeOutboxHeader();
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // The last gathered reading is live only if it was taken within the
+    // last sampling interval, i.e. no newer reading of its sensor can exist
+    // yet. A reading held in RAM through an outage, however short, is old.
+    const SensorSnapshot &last = drainBuffer[count - 1];
+    bool lastIsLive = count > fromFlash &&
+                      millis() - last.timestamp <
+                          runtimeConfig().sampleIntervalMs;
+    size_t published = publish(drainBuffer, count, lastIsLive);
+
+    // Drop what was published, oldest first
+    for (size_t i = 0; i < published; i++) {
+        if (i < fromFlash) {
+            dropOldestFromFlash();
+        } else {
+            ramQueue.pop();
+        }
+    }
+
+    // Write the header once per batch instead of once per reading,
+    // to spare the flash
+    if (published > 0 && fromFlash > 0) {
+        writeOutboxHeader();
+    }
+
+    return published;
+}
+
+size_t pendingReadings() {
+    return ramQueue.size() + (outboxReady ? outboxHeader.count : 0);
+}
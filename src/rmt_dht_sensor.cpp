@@ -0,0 +1,189 @@
+/*
+ * File: rmt_dht_sensor.cpp
+ * Description: RMT-based DHT11/DHT22 driver.
+ *
+ * A transaction goes through three steps, none of which busy-waits:
+ *   1. startRead() pulls the line low and arms a one-shot timer
+ *   2. onStartPulseDone() releases the line and starts the RMT receiver,
+ *      which timestamps every edge of the sensor's answer in hardware
+ *   3. onFrameDone() fetches the captured items, decodes the 40 bits and
+ *      calls the completion callback
+ */
+
+#include "rmt_dht_sensor.h"
+
+#include <DHT.h>
+#include <driver/gpio.h>
+
+// Minimum time between two transactions, required by the sensors
+const uint32_t DHT_MIN_INTERVAL_MS = 2000;
+
+// Length of the start pulse: at least 18 ms for the DHT11, 1 ms for the DHT22
+const uint64_t DHT11_START_PULSE_US = 20000;
+const uint64_t DHT22_START_PULSE_US = 1100;
+
+// A full frame (response + 40 bits) lasts at most about 5 ms
+const uint64_t DHT_FRAME_TIMEOUT_US = 8000;
+
+// High pulses longer than this are ones, shorter ones are zeros
+// (about 27 us and 70 us respectively)
+const uint32_t DHT_ONE_THRESHOLD_US = 48;
+
+// How long a blocking read waits for the completion callback
+const TickType_t DHT_BLOCKING_TIMEOUT = pdMS_TO_TICKS(100);
+
+void RmtDhtSensor::begin() {
+    // 1 us per RMT tick; the receiver stops after 200 us without an edge,
+    // which only happens once the sensor has released the line
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)pin, channel);
+    config.clk_div = 80;
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = 100;
+    config.rx_config.idle_threshold = 200;
+    if (rmt_config(&config) != ESP_OK ||
+        rmt_driver_install(channel, 1024, 0) != ESP_OK ||
+        rmt_get_ringbuf_handle(channel, &ringBuffer) != ESP_OK) {
+        ringBuffer = nullptr;
+        return;
+    }
+
+    // Open drain: writing 0 pulls the line low, writing 1 releases it to
+    // the pull-up, and the RMT receiver keeps seeing the pin as input
+    gpio_set_direction((gpio_num_t)pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_pull_mode((gpio_num_t)pin, GPIO_PULLUP_ONLY);
+    gpio_set_level((gpio_num_t)pin, 1);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.arg = this;
+    timerArgs.callback = onStartPulseDone;
+    timerArgs.name = "dht_start";
+    esp_timer_create(&timerArgs, &startTimer);
+    timerArgs.callback = onFrameDone;
+    timerArgs.name = "dht_frame";
+    esp_timer_create(&timerArgs, &frameTimer);
+
+    readDone = xSemaphoreCreateBinary();
+}
+
+bool RmtDhtSensor::startRead(ReadCallback callback, void *context) {
+    if (ringBuffer == nullptr || busy) {
+        return false;
+    }
+    busy = true;
+    this->callback = callback;
+    callbackContext = context;
+
+    gpio_set_level((gpio_num_t)pin, 0);
+    esp_timer_start_once(startTimer, type == DHT11 ? DHT11_START_PULSE_US
+                                                   : DHT22_START_PULSE_US);
+    return true;
+}
+
+void RmtDhtSensor::onStartPulseDone(void *arg) {
+    RmtDhtSensor *sensor = static_cast<RmtDhtSensor *>(arg);
+    gpio_set_level((gpio_num_t)sensor->pin, 1);
+    rmt_rx_start(sensor->channel, true);
+    esp_timer_start_once(sensor->frameTimer, DHT_FRAME_TIMEOUT_US);
+}
+
+void RmtDhtSensor::onFrameDone(void *arg) {
+    RmtDhtSensor *sensor = static_cast<RmtDhtSensor *>(arg);
+    rmt_rx_stop(sensor->channel);
+
+    Sample sample = {NAN, NAN};
+    SampleStatus status = SAMPLE_TIMEOUT;
+    size_t length = 0;
+    rmt_item32_t *items = static_cast<rmt_item32_t *>(
+        xRingbufferReceive(sensor->ringBuffer, &length, 0));
+    if (items != nullptr) {
+        status = sensor->decode(items, length / sizeof(rmt_item32_t), sample);
+        vRingbufferReturnItem(sensor->ringBuffer, items);
+    }
+
+    sensor->finishRead(status, sample);
+}
+
+SampleStatus RmtDhtSensor::decode(const rmt_item32_t *items, size_t count,
+                                  Sample &sample) const {
+    // Every bit is a low pulse followed by a high pulse whose length gives
+    // its value. The frame ends with a low pulse and the idle high line,
+    // whose item has no high duration: it is skipped. The response pulses
+    // (80 us each) come before, so the bits are the last 40 low/high pairs.
+    size_t pairs[40];
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].level0 == 0 && items[i].level1 == 1 &&
+            items[i].duration1 != 0) {
+            pairs[found % 40] = i;
+            found++;
+        }
+    }
+    if (found < 40) {
+        return SAMPLE_TIMEOUT;
+    }
+
+    uint8_t data[5] = {};
+    for (size_t bit = 0; bit < 40; bit++) {
+        const rmt_item32_t &item = items[pairs[(found + bit) % 40]];
+        data[bit / 8] <<= 1;
+        if (item.duration1 > DHT_ONE_THRESHOLD_US) {
+            data[bit / 8] |= 1;
+        }
+    }
+
+    if (((data[0] + data[1] + data[2] + data[3]) & 0xFF) != data[4]) {
+        return SAMPLE_CHECKSUM_ERROR;
+    }
+
+    // Same conversions as the Adafruit library
+    if (type == DHT11) {
+        sample.humidity = data[0] + data[1] * 0.1f;
+        sample.temperature = data[2] + (data[3] & 0x0F) * 0.1f;
+        if (data[3] & 0x80) {
+            sample.temperature = -sample.temperature;
+        }
+    } else {
+        sample.humidity = ((data[0] << 8) | data[1]) * 0.1f;
+        sample.temperature = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+        if (data[2] & 0x80) {
+            sample.temperature = -sample.temperature;
+        }
+    }
+    return SAMPLE_OK;
+}
+
+void RmtDhtSensor::finishRead(SampleStatus status, const Sample &sample) {
+    ReadCallback done = callback;
+    void *context = callbackContext;
+    busy = false;
+    if (done != nullptr) {
+        done(context, status, sample);
+    }
+}
+
+void RmtDhtSensor::onBlockingReadDone(void *context, SampleStatus status,
+                                      const Sample &sample) {
+    RmtDhtSensor *sensor = static_cast<RmtDhtSensor *>(context);
+    sensor->lastStatus = status;
+    sensor->lastSample = sample;
+    xSemaphoreGive(sensor->readDone);
+}
+
+SampleStatus RmtDhtSensor::readSample(Sample &sample) {
+    // Like the Adafruit library, reuse the last result when the sensor
+    // cannot be asked again yet
+    unsigned long now = millis();
+    if (!hasRead || now - lastReadTime >= DHT_MIN_INTERVAL_MS) {
+        hasRead = true;
+        lastReadTime = now;
+        lastStatus = SAMPLE_ERROR;
+        if (startRead(onBlockingReadDone, this) &&
+            xSemaphoreTake(readDone, DHT_BLOCKING_TIMEOUT) != pdTRUE) {
+            // The timers always end the transaction, so this is only a guard
+            lastStatus = SAMPLE_TIMEOUT;
+        }
+    }
+
+    sample = lastSample;
+    return lastStatus;
+}
@@ -0,0 +1,176 @@
+/*
+ * File: rollup_store.cpp
+ * Description: Hourly rollups of the readings, persisted in a ring file.
+ *
+ * Records are appended in the order the hours end, so they are sorted by
+ * start time, except for the hours rebuilt after a restart, which are at
+ * most ROLLUP_REBUILD_S older than the records before them. Range queries
+ * rely on that to binary search the first record to read.
+ */
+
+#include "rollup_store.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/semphr.h>
+
+#include "log.h"
+#include "sampling.h"
+
+// Path of the ring file
+const char *ROLLUP_PATH = "/rollups.bin";
+
+// Identifies a written record
+const uint32_t ROLLUP_MAGIC = 0x524f4c4c;  // "ROLL"
+
+struct RollupRecord {
+    uint32_t magic;
+    uint32_t sequence;  // Increases with every record written
+    uint8_t sensor;
+    uint8_t reserved[3];
+    Rollup rollup;
+};
+
+File rollupFile;
+bool rollupsReady = false;
+
+// Record to write next, and its sequence number
+uint32_t nextRecord = 0;
+uint32_t nextRecordSequence = 1;
+
+// Start of the newest record of each sensor, 0 if none
+uint32_t lastStoredHours[MAX_SENSORS] = {};
+
+// Guards the file: readers may run in another task
+SemaphoreHandle_t rollupLock = nullptr;
+
+// Number of records the file holds so far (it grows until ROLLUP_RECORDS)
+uint32_t recordsInFile() {
+    uint32_t records = rollupFile.size() / sizeof(RollupRecord);
+    return records < ROLLUP_RECORDS ? records : ROLLUP_RECORDS;
+}
+
+bool readRecord(uint32_t index, RollupRecord &record) {
+    rollupFile.seek(index * sizeof(RollupRecord), SeekSet);
+    return rollupFile.read(reinterpret_cast<uint8_t *>(&record),
+                           sizeof(record)) == sizeof(record) &&
+           record.magic == ROLLUP_MAGIC;
+}
+
+void storeRollup(uint8_t sensor, const Rollup &rollup) {
+    if (!rollupsReady || sensor >= MAX_SENSORS) {
+        return;
+    }
+    RollupRecord record = {};
+    record.magic = ROLLUP_MAGIC;
+    record.sensor = sensor;
+    record.rollup = rollup;
+
+    xSemaphoreTake(rollupLock, portMAX_DELAY);
+    record.sequence = nextRecordSequence++;
+    rollupFile.seek(nextRecord * sizeof(RollupRecord), SeekSet);
+    rollupFile.write(reinterpret_cast<const uint8_t *>(&record),
+                     sizeof(record));
+    rollupFile.flush();
+    nextRecord = (nextRecord + 1) % ROLLUP_RECORDS;
+    if (rollup.start > lastStoredHours[sensor]) {
+        lastStoredHours[sensor] = rollup.start;
+    }
+    xSemaphoreGive(rollupLock);
+}
+
+uint32_t lastStoredRollup(uint8_t sensor) {
+    xSemaphoreTake(rollupLock, portMAX_DELAY);
+    uint32_t start = sensor < MAX_SENSORS ? lastStoredHours[sensor] : 0;
+    xSemaphoreGive(rollupLock);
+    return start;
+}
+
+void setupRollupStore() {
+    rollupLock = xSemaphoreCreateMutex();
+
+    if (!LittleFS.exists(ROLLUP_PATH)) {
+        File created = LittleFS.open(ROLLUP_PATH, "w");
+        created.close();
+    }
+    rollupFile = LittleFS.open(ROLLUP_PATH, "r+");
+    if (!rollupFile) {
+        LOG_ERROR("Failed to open the rollup file, no rollups");
+        return;
+    }
+
+    // Continue after the newest record
+    uint32_t records = recordsInFile();
+    uint32_t newestSequence = 0;
+    for (uint32_t index = 0; index < records; index++) {
+        RollupRecord record;
+        if (!readRecord(index, record) || record.sensor >= MAX_SENSORS) {
+            continue;
+        }
+        if (record.sequence >= newestSequence) {
+            newestSequence = record.sequence;
+            nextRecord = (index + 1) % ROLLUP_RECORDS;
+            nextRecordSequence = record.sequence + 1;
+        }
+        uint32_t &last = lastStoredHours[record.sensor];
+        if (record.rollup.start > last) {
+            last = record.rollup.start;
+        }
+    }
+    rollupsReady = true;
+    LOG_INFO("Rollups: %u hours in flash", records);
+}
+
+size_t readRollups(uint8_t sensor, uint32_t from, uint32_t to,
+                   RollupVisitor visitor, void *context) {
+    if (!rollupsReady || sensor >= MAX_SENSORS) {
+        return 0;
+    }
+
+    // Find a record before which none can start at `from` or later: the
+    // first one of a run at least ROLLUP_REBUILD_S before `from`
+    uint32_t earliest = from > ROLLUP_REBUILD_S ? from - ROLLUP_REBUILD_S : 0;
+    xSemaphoreTake(rollupLock, portMAX_DELAY);
+    uint32_t records = recordsInFile();
+    uint32_t oldest = records < ROLLUP_RECORDS ? 0 : nextRecord;
+    uint32_t low = 0;
+    uint32_t high = records;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        RollupRecord record;
+        if (readRecord((oldest + middle) % records, record) &&
+            record.rollup.start >= earliest) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    xSemaphoreGive(rollupLock);
+
+    // Records are read one at a time, so the aggregation task can store
+    // new ones in between
+    size_t visited = 0;
+    for (uint32_t i = low; i < records; i++) {
+        RollupRecord record;
+        xSemaphoreTake(rollupLock, portMAX_DELAY);
+        bool found = readRecord((oldest + i) % records, record);
+        xSemaphoreGive(rollupLock);
+
+        if (!found) {
+            continue;
+        }
+        if (record.rollup.start > to &&
+            record.rollup.start - to > ROLLUP_REBUILD_S) {
+            return visited;  // No later record can be in the range
+        }
+        if (record.sensor != sensor || record.rollup.start < from ||
+            record.rollup.start > to) {
+            continue;
+        }
+        visited++;
+        if (!visitor(record.rollup, context)) {
+            return visited;
+        }
+    }
+    return visited;
+}
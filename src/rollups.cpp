@@ -0,0 +1,149 @@
+/*
+ * File: rollups.cpp
+ * Description: Incremental minute, hour and day rollups of the readings.
+ */
+
+#include "rollups.h"
+
+#include <Arduino.h>
+
+#include "history_store.h"
+#include "log.h"
+#include "metrics.h"
+#include "rollup_store.h"
+#include "spsc_queue.h"
+
+const char *ROLLUP_NAMES[ROLLUPS_COUNT] = {"1m", "1h", "1d"};
+
+static_assert(ROLLUP_PERIODS_S[ROLLUP_HOUR] == ROLLUP_PERIOD_S,
+              "Hours are the resolution stored in flash");
+
+// Bucket in progress of each sensor and resolution. Only the aggregation
+// task writes them, under the lock since web handlers may read them.
+Rollup buckets[MAX_SENSORS][ROLLUPS_COUNT] = {};
+portMUX_TYPE rollupsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Closed buckets waiting for MQTT, from the aggregation task to the
+// network task
+SpscQueue<ClosedRollup, ROLLUP_QUEUE_SIZE> closedRollups;
+
+// Whether the buckets of each sensor have been rebuilt since boot
+bool rebuilt[MAX_SENSORS] = {};
+
+// Store and queue a bucket that is over. `replaying` is set while
+// rebuilding after a restart: the minutes are then long gone, and only
+// the hours and days are worth publishing.
+void closeBucket(uint8_t sensor, RollupResolution resolution,
+                 const Rollup &bucket, bool replaying) {
+    if (resolution == ROLLUP_HOUR) {
+        storeRollup(sensor, bucket);
+    }
+    if (replaying && resolution == ROLLUP_MINUTE) {
+        return;
+    }
+    if (!closedRollups.push({sensor, resolution, bucket})) {
+        countMetric(metrics.rollupsDropped);
+        LOG_EVERY(60000, LOG_WARN("Rollup queue full, dropping the newest"));
+    }
+}
+
+void addToBuckets(uint8_t sensor, uint32_t epoch, float temperature,
+                  float humidity, bool replaying) {
+    for (int i = 0; i < ROLLUPS_COUNT; i++) {
+        RollupResolution resolution = static_cast<RollupResolution>(i);
+        uint32_t start = epoch - epoch % ROLLUP_PERIODS_S[resolution];
+        Rollup &bucket = buckets[sensor][resolution];
+
+        // The bucket is stored before it is reset: a range query may count
+        // an hour twice for a moment (and skips it), but never misses it
+        if (bucket.count > 0 && bucket.start != start) {
+            closeBucket(sensor, resolution, bucket, replaying);
+        }
+
+        portENTER_CRITICAL(&rollupsLock);
+        if (bucket.count == 0 || bucket.start != start) {
+            bucket.reset(start);
+        }
+        bucket.add(temperature, humidity);
+        portEXIT_CRITICAL(&rollupsLock);
+    }
+}
+
+bool replaySample(const HistorySample &sample, void *context) {
+    uint8_t sensor = *static_cast<uint8_t *>(context);
+    addToBuckets(sensor, sample.epoch, sample.temperature, sample.humidity,
+                 true);
+    return true;
+}
+
+bool mergeHour(const Rollup &hour, void *context) {
+    static_cast<Rollup *>(context)->merge(hour);
+    return true;
+}
+
+// Rebuild the buckets a restart interrupted: the day from the hours
+// stored so far, then the rest by replaying the history since the last
+// stored hour (at most ROLLUP_REBUILD_S of it, once per boot)
+void rebuildBuckets(uint8_t sensor, uint32_t epoch) {
+    uint32_t hourStart = epoch - epoch % ROLLUP_PERIODS_S[ROLLUP_HOUR];
+    uint32_t from = hourStart - ROLLUP_REBUILD_S;
+    uint32_t last = lastStoredRollup(sensor);
+    if (last != 0 && last + ROLLUP_PERIODS_S[ROLLUP_HOUR] > from) {
+        from = last + ROLLUP_PERIODS_S[ROLLUP_HOUR];
+    }
+    if (from >= epoch) {
+        return;
+    }
+
+    Rollup day = {};
+    day.reset(from - from % ROLLUP_PERIODS_S[ROLLUP_DAY]);
+    if (from > day.start) {
+        readRollups(sensor, day.start, from - 1, mergeHour, &day);
+    }
+    if (day.count > 0) {
+        portENTER_CRITICAL(&rollupsLock);
+        buckets[sensor][ROLLUP_DAY] = day;
+        portEXIT_CRITICAL(&rollupsLock);
+    }
+
+    size_t replayed = readHistory(sensor, from, epoch - 1, replaySample,
+                                  &sensor);
+    LOG_INFO("Rollups of sensor %u rebuilt from %u samples", sensor,
+             (unsigned)replayed);
+}
+
+void recordRollups(const SensorSnapshot &reading) {
+    // A failed read repeats the previous values, it would only weigh them
+    if (reading.epoch == 0 || !reading.sensorOk) {
+        return;
+    }
+    if (!rebuilt[reading.sensor]) {
+        rebuildBuckets(reading.sensor, reading.epoch);
+        rebuilt[reading.sensor] = true;
+    }
+    addToBuckets(reading.sensor, reading.epoch, reading.avgTemperature,
+                 reading.avgHumidity, false);
+}
+
+bool currentRollup(uint8_t sensor, RollupResolution resolution,
+                   Rollup &rollup) {
+    if (sensor >= MAX_SENSORS) {
+        return false;
+    }
+    portENTER_CRITICAL(&rollupsLock);
+    rollup = buckets[sensor][resolution];
+    portEXIT_CRITICAL(&rollupsLock);
+    return rollup.count > 0;
+}
+
+size_t drainRollups(RollupPublisher publish, size_t maxRollups) {
+    size_t published = 0;
+    while (published < maxRollups && !closedRollups.empty()) {
+        if (!publish(closedRollups.front())) {
+            break;
+        }
+        closedRollups.pop();
+        published++;
+    }
+    return published;
+}
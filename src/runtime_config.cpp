@@ -0,0 +1,186 @@
+/*
+ * File: runtime_config.cpp
+ * Description: Runtime settings, received over MQTT and saved in NVS.
+ */
+
+#include "runtime_config.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "payload.h"
+#include "publish_queue.h"
+#include "sampling.h"
+#include "snapshot_buffer.h"
+
+// NVS namespace and key of the saved config
+const char *RUNTIME_CONFIG_NAMESPACE = "config";
+const char *RUNTIME_CONFIG_KEY = "runtime";
+
+// Written by the network task only, read by the sampling task as well
+SnapshotBuffer<RuntimeConfig> currentConfig;
+
+char deviceIdText[13] = "";
+char configTopic[40] = "";
+
+RuntimeConfig defaultRuntimeConfig() {
+    RuntimeConfig config;
+    config.sampleIntervalMs = SAMPLE_INTERVAL_MS;
+    config.windowSize = MOVING_AVERAGE_SIZE;
+    config.deadband.temperature = DEADBAND_TEMPERATURE;
+    config.deadband.humidity = DEADBAND_HUMIDITY;
+    config.deadband.heartbeatMs = DEADBAND_HEARTBEAT_MS;
+    config.batchSamples = PUBLISH_BATCH_SAMPLES;
+    config.batchFlushMs = PUBLISH_BATCH_FLUSH_MS;
+    return config;
+}
+
+// Check every field against the limits of this firmware. The window and
+// the batch cannot grow past the buffers allocated at compile time.
+bool validInterval(uint32_t value) {
+    return value >= MIN_SAMPLE_INTERVAL_MS && value <= MAX_SAMPLE_INTERVAL_MS;
+}
+
+bool validWindow(uint32_t value) {
+    return value >= 1 && value <= MOVING_AVERAGE_SIZE;
+}
+
+bool validBatch(uint32_t value) {
+    return value >= 1 && value <= MAX_BATCH_SAMPLES;
+}
+
+// Any duration that fits in 32 bits (about 49 days) will do
+bool validDuration(uint32_t) {
+    return true;
+}
+
+bool validThreshold(float value) {
+    return value >= 0;
+}
+
+bool validRuntimeConfig(const RuntimeConfig &config) {
+    return validInterval(config.sampleIntervalMs) &&
+           validWindow(config.windowSize) &&
+           validThreshold(config.deadband.temperature) &&
+           validThreshold(config.deadband.humidity) &&
+           validBatch(config.batchSamples);
+}
+
+void loadRuntimeConfig() {
+    RuntimeConfig config;
+    Preferences preferences;
+    preferences.begin(RUNTIME_CONFIG_NAMESPACE, true);
+    size_t length =
+        preferences.getBytes(RUNTIME_CONFIG_KEY, &config, sizeof(config));
+    preferences.end();
+
+    // A config saved by a firmware with other limits may no longer fit
+    if (length != sizeof(config) || !validRuntimeConfig(config)) {
+        config = defaultRuntimeConfig();
+    } else {
+        LOG_INFO("Loaded runtime config from NVS");
+    }
+    currentConfig.publish(config);
+}
+
+RuntimeConfig runtimeConfig() {
+    RuntimeConfig config;
+    if (currentConfig.read(config) == 0) {
+        config = defaultRuntimeConfig();
+    }
+    return config;
+}
+
+void saveRuntimeConfig(const RuntimeConfig &config) {
+    Preferences preferences;
+    preferences.begin(RUNTIME_CONFIG_NAMESPACE, false);
+    preferences.putBytes(RUNTIME_CONFIG_KEY, &config, sizeof(config));
+    preferences.end();
+}
+
+// Read one key of the JSON object into `field` if it is present and valid.
+// Counts, durations and intervals are whole numbers; only the thresholds
+// are floats.
+bool readSetting(const char *json, const char *key, bool (*valid)(uint32_t),
+                 uint32_t &field) {
+    uint32_t value;
+    if (!findJsonUnsigned(json, key, value)) {
+        return false;
+    }
+    if (!valid(value)) {
+        LOG_WARN("Ignoring out-of-range config value %s=%u", key, value);
+        return false;
+    }
+    field = value;
+    return true;
+}
+
+bool readSetting(const char *json, const char *key, bool (*valid)(float),
+                 float &field) {
+    float value;
+    if (!findJsonNumber(json, key, value)) {
+        return false;
+    }
+    if (!valid(value)) {
+        LOG_WARN("Ignoring out-of-range config value %s=%g", key, value);
+        return false;
+    }
+    field = value;
+    return true;
+}
+
+bool applyRuntimeConfig(const char *json) {
+    RuntimeConfig config = runtimeConfig();
+    bool found = false;
+    found |= readSetting(json, "interval_ms", validInterval,
+                         config.sampleIntervalMs);
+    found |= readSetting(json, "window", validWindow, config.windowSize);
+    found |= readSetting(json, "deadband_temperature", validThreshold,
+                         config.deadband.temperature);
+    found |= readSetting(json, "deadband_humidity", validThreshold,
+                         config.deadband.humidity);
+    found |= readSetting(json, "heartbeat_ms", validDuration,
+                         config.deadband.heartbeatMs);
+    found |= readSetting(json, "batch", validBatch, config.batchSamples);
+    found |= readSetting(json, "batch_flush_ms", validDuration,
+                         config.batchFlushMs);
+    if (!found) {
+        return false;
+    }
+
+    // The broker sends the retained config on every reconnection: only
+    // write the flash when something really changed
+    RuntimeConfig previous = runtimeConfig();
+    if (memcmp(&config, &previous, sizeof(config)) == 0) {
+        return true;
+    }
+    currentConfig.publish(config);
+    saveRuntimeConfig(config);
+    LOG_INFO("Runtime config: interval %u ms, window %u, deadband %.2f/%.2f, "
+             "heartbeat %u ms, batch %u, flush %u ms",
+             config.sampleIntervalMs, config.windowSize,
+             config.deadband.temperature, config.deadband.humidity,
+             config.deadband.heartbeatMs, config.batchSamples,
+             config.batchFlushMs);
+    return true;
+}
+
+const char *deviceId() {
+    if (deviceIdText[0] == '\0') {
+        uint64_t mac = ESP.getEfuseMac();
+        snprintf(deviceIdText, sizeof(deviceIdText), "%012llx",
+                 (unsigned long long)(mac & 0xFFFFFFFFFFFFULL));
+    }
+    return deviceIdText;
+}
+
+const char *runtimeConfigTopic() {
+    if (configTopic[0] == '\0') {
+        snprintf(configTopic, sizeof(configTopic), "esp32/%s/config",
+                 deviceId());
+    }
+    return configTopic;
+}
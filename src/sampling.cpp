@@ -0,0 +1,290 @@
+/*
+ * File: sampling.cpp
+ * Description: Sampling task that owns the sensors. It reads the
+ *              temperature and humidity of each one at a fixed interval,
+ *              calculates the moving averages and publishes them as a
+ *              snapshot per sensor.
+ */
+
+#include "sampling.h"
+
+#include <Arduino.h>
+#include <time.h>
+#include <atomic>
+
+#include "dht_sensor.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "rmt_dht_sensor.h"
+#include "runtime_config.h"
+#include "sample_filter.h"
+#include "snapshot_buffer.h"
+#include "spsc_queue.h"
+#include "task_layout.h"
+
+// Sensors wired to the board: DHT11/DHT22 pin and type.
+// With -D DHT_DRIVER_RMT the frames are captured by the RMT peripheral
+// (one channel per sensor) instead of the Adafruit library, which disables
+// interrupts for the ~5 ms of every read.
+#ifdef DHT_DRIVER_RMT
+RmtDhtSensor dht0(4, DHT11, RMT_CHANNEL_0);
+#else
+DhtSensor dht0(4, DHT11);
+#endif
+
+// Every sensor read by the sampling task, up to MAX_SENSORS.
+// Add a line per sensor (e.g. {"dht1", "esp32/dht1", &dht1}).
+// The first one feeds the web page; its MQTT topics start with "esp32/".
+const SensorDefinition SENSORS[] = {
+    {"dht0", "esp32", &dht0},
+};
+const size_t SENSOR_COUNT = sizeof(SENSORS) / sizeof(SENSORS[0]);
+static_assert(SENSOR_COUNT >= 1 && SENSOR_COUNT <= MAX_SENSORS,
+              "Between 1 and MAX_SENSORS sensors are supported");
+
+// Filter applied to the readings, one of the FILTER_* values of
+// sample_filter.h, e.g. -D SAMPLE_FILTER=FILTER_MEDIAN. The window filters
+// (mean and median) use the window size of the runtime config, at most
+// MOVING_AVERAGE_WINDOW readings.
+#ifndef SAMPLE_FILTER
+#define SAMPLE_FILTER FILTER_MEAN
+#endif
+
+// Weight of the newest reading for FILTER_EMA
+#ifndef FILTER_EMA_ALPHA
+#define FILTER_EMA_ALPHA 0.2f
+#endif
+
+// Variances of FILTER_KALMAN: drift between two readings, and noise of one
+// reading (the DHT11 resolution is 1 degree / 1 %)
+#ifndef FILTER_KALMAN_PROCESS_NOISE
+#define FILTER_KALMAN_PROCESS_NOISE 0.01f
+#endif
+#ifndef FILTER_KALMAN_MEASUREMENT_NOISE
+#define FILTER_KALMAN_MEASUREMENT_NOISE 1.0f
+#endif
+
+#if SAMPLE_FILTER == FILTER_MEAN
+typedef MeanFilter<float, MOVING_AVERAGE_SIZE> ReadingFilter;
+constexpr ReadingFilter newReadingFilter() { return ReadingFilter(); }
+#elif SAMPLE_FILTER == FILTER_MEDIAN
+typedef MedianFilter<float, MOVING_AVERAGE_SIZE> ReadingFilter;
+constexpr ReadingFilter newReadingFilter() { return ReadingFilter(); }
+#elif SAMPLE_FILTER == FILTER_EMA
+typedef EmaFilter<float> ReadingFilter;
+constexpr ReadingFilter newReadingFilter() {
+    return ReadingFilter(FILTER_EMA_ALPHA);
+}
+#elif SAMPLE_FILTER == FILTER_KALMAN
+typedef KalmanFilter<float> ReadingFilter;
+constexpr ReadingFilter newReadingFilter() {
+    return ReadingFilter(FILTER_KALMAN_PROCESS_NOISE,
+                         FILTER_KALMAN_MEASUREMENT_NOISE);
+}
+#else
+#error "Unknown SAMPLE_FILTER"
+#endif
+
+// Spike rejection: a sample whose temperature or humidity jumps more than
+// this from the last accepted one is dropped (0 disables the check)...
+#ifndef SPIKE_MAX_TEMPERATURE_STEP
+#define SPIKE_MAX_TEMPERATURE_STEP 5.0f
+#endif
+#ifndef SPIKE_MAX_HUMIDITY_STEP
+#define SPIKE_MAX_HUMIDITY_STEP 15.0f
+#endif
+
+// ...unless this many samples in a row were already dropped, which means
+// the conditions really changed (e.g. the sensor was moved)
+#ifndef SPIKE_MAX_REJECTIONS
+#define SPIKE_MAX_REJECTIONS 3
+#endif
+
+// In low-power mode the state below lives in RTC memory, so the moving
+// averages survive the deep sleeps between readings. All of it is constant
+// initialized, so it is only reset on a cold boot.
+#ifdef LOW_POWER_MODE
+#define SLEEP_PERSISTENT RTC_DATA_ATTR
+#else
+#define SLEEP_PERSISTENT
+#endif
+
+// Filter state of one sensor.
+// Only the sampling task touches it, so it needs no locking.
+struct SensorState {
+    ReadingFilter temperatureFilter = newReadingFilter();
+    ReadingFilter humidityFilter = newReadingFilter();
+    uint32_t windowSize = MOVING_AVERAGE_SIZE;
+
+    // Last accepted readings, and the spikes dropped in a row
+    SpikeGate<float> temperatureGate{SPIKE_MAX_TEMPERATURE_STEP};
+    SpikeGate<float> humidityGate{SPIKE_MAX_HUMIDITY_STEP};
+    uint32_t spikesInARow = 0;
+
+    // Number of readings taken, and failed by the sensor (NaN), since boot
+    uint32_t sampleCount = 0;
+    uint32_t failedReadings = 0;
+};
+
+SLEEP_PERSISTENT SensorState sensorStates[SENSOR_COUNT];
+
+// Latest snapshot of every sensor, written by the sampling task only
+SnapshotBuffer<SensorSnapshot> latestSnapshots[SENSOR_COUNT];
+
+// Every snapshot, in order, from the sampling task to the task set by
+// forwardSamples()
+SpscQueue<SensorSnapshot, SAMPLE_QUEUE_SIZE> sampleQueue;
+std::atomic<TaskHandle_t> sampleConsumer{nullptr};
+
+// Run one transaction on a sensor and feed both values to their filters,
+// so the temperature and humidity series stay aligned sample by sample.
+// Returns false if the sensor failed or the sample was dropped as a spike;
+// the filters are then left untouched.
+bool readSampleAndUpdateFilters(PolledSensor &sensor, SensorState &state) {
+    Sample sample;
+    uint32_t readStart = micros();
+    SampleStatus status = sensor.readSample(sample);
+    metrics.dhtReadDuration.observe(micros() - readStart);
+    if (status != SAMPLE_OK || isnan(sample.temperature) ||
+        isnan(sample.humidity)) {
+        state.failedReadings++;
+        countMetric(metrics.dhtReadFailures);
+        return false;
+    }
+
+    bool spike = state.temperatureGate.isSpike(sample.temperature) ||
+                 state.humidityGate.isSpike(sample.humidity);
+    if (spike && state.spikesInARow < SPIKE_MAX_REJECTIONS) {
+        state.spikesInARow++;
+        countMetric(metrics.spikesRejected);
+        return false;
+    }
+    state.spikesInARow = 0;
+
+    state.temperatureGate.accept(sample.temperature);
+    state.humidityGate.accept(sample.humidity);
+    state.temperatureFilter.update(sample.temperature);
+    state.humidityFilter.update(sample.humidity);
+    return true;
+}
+
+void beginSensors() {
+    for (size_t i = 0; i < SENSOR_COUNT; i++) {
+        SENSORS[i].sensor->begin();
+    }
+}
+
+bool takeReading(size_t sensorIndex, SensorSnapshot &snapshot) {
+    PolledSensor &sensor = *SENSORS[sensorIndex].sensor;
+    SensorState &state = sensorStates[sensorIndex];
+
+    // Follow the window size of the runtime config. Shrinking keeps the
+    // most recent readings, so the estimate does not restart from scratch.
+    uint32_t windowSize = runtimeConfig().windowSize;
+    if (windowSize != state.windowSize) {
+        state.temperatureFilter.resize(windowSize);
+        state.humidityFilter.resize(windowSize);
+        state.windowSize = windowSize;
+    }
+
+    // On a failure the previous estimates and last valid readings are kept
+    snapshot.sensorOk = readSampleAndUpdateFilters(sensor, state);
+    snapshot.avgTemperature = state.temperatureFilter.value();
+    snapshot.avgHumidity = state.humidityFilter.value();
+    snapshot.rawTemperature = state.temperatureGate.lastAccepted();
+    snapshot.rawHumidity = state.humidityGate.lastAccepted();
+    snapshot.timestamp = millis();
+    time_t now = time(nullptr);
+    snapshot.epoch = now >= MIN_VALID_EPOCH ? now : 0;
+    snapshot.sampleCount = ++state.sampleCount;
+    snapshot.failedReadings = state.failedReadings;
+    snapshot.sensor = sensorIndex;
+
+    // Until the sensor has produced one valid sample there is nothing to
+    // report: the filters do not hold an estimate yet
+    return !state.temperatureFilter.empty();
+}
+
+// Queue a snapshot for the consumer, if there is one yet. A consumer that
+// falls behind loses the newest snapshots, the sampling never waits.
+void forwardSample(const SensorSnapshot &snapshot) {
+    TaskHandle_t consumer = sampleConsumer.load(std::memory_order_acquire);
+    if (consumer == nullptr) {
+        return;
+    }
+    if (sampleQueue.push(snapshot)) {
+        xTaskNotifyGive(consumer);
+    } else {
+        countMetric(metrics.samplesDropped);
+    }
+}
+
+// Body of the sampling task. Every sensor is read once per sampling
+// interval (SAMPLE_INTERVAL_MS unless changed at runtime), but the reads
+// are staggered: the task wakes up SENSOR_COUNT times per interval and
+// reads one sensor each time, so blocking single-wire transactions never
+// pile up in the same tick.
+void samplingTask(void *parameter) {
+    SensorSnapshot snapshot;
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    size_t next = 0;
+#ifdef PROFILE
+    int64_t lastWakeTimeUs = 0;
+#endif
+
+    for (;;) {
+        // Sleep until the next reading, keeping a fixed cadence.
+        // Waiting first also gives the sensors time to settle after begin()
+        uint32_t intervalMs = runtimeConfig().sampleIntervalMs;
+        vTaskDelayUntil(&lastWakeTime,
+                        pdMS_TO_TICKS(intervalMs / SENSOR_COUNT));
+#ifdef PROFILE
+        // Jitter of the cadence: the spread of the time between wake-ups
+        int64_t wakeTime = esp_timer_get_time();
+        if (lastWakeTimeUs != 0) {
+            PROFILE_RECORD(PROFILE_SAMPLE_PERIOD, wakeTime - lastWakeTimeUs);
+        }
+        lastWakeTimeUs = wakeTime;
+#endif
+
+        {
+            PROFILE_SCOPE(PROFILE_SAMPLING);
+            if (takeReading(next, snapshot)) {
+                latestSnapshots[next].publish(snapshot);
+                forwardSample(snapshot);
+            }
+        }
+        next = (next + 1) % SENSOR_COUNT;
+    }
+}
+
+void startSamplingTask() {
+    beginSensors();
+    xTaskCreatePinnedToCore(samplingTask, "sampling", SAMPLING_TASK_STACK_SIZE,
+                            nullptr, SAMPLING_TASK_PRIORITY, nullptr,
+                            SAMPLING_TASK_CORE);
+}
+
+void forwardSamples(TaskHandle_t consumer) {
+    sampleConsumer.store(consumer, std::memory_order_release);
+}
+
+bool takeSample(SensorSnapshot &snapshot) {
+    return sampleQueue.pop(snapshot);
+}
+
+size_t sensorCount() {
+    return SENSOR_COUNT;
+}
+
+const SensorDefinition &sensorDefinition(size_t sensorIndex) {
+    return SENSORS[sensorIndex];
+}
+
+uint32_t readSnapshot(size_t sensorIndex, SensorSnapshot &snapshot) {
+    return latestSnapshots[sensorIndex].read(snapshot);
+}
+
+uint32_t readSnapshot(SensorSnapshot &snapshot) {
+    return readSnapshot(0, snapshot);
+}
@@ -0,0 +1,225 @@
+/*
+ * File: wifi_connection.cpp
+ * Description: Event-driven Wi-Fi connection with a cached fast path.
+ */
+
+#include "wifi_connection.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <freertos/event_groups.h>
+#include <string.h>
+
+#include "backoff.h"
+#include "log.h"
+
+// Details of the last good connection, stored in NVS as one blob
+struct WifiCache {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+// NVS namespace and key of the cache
+const char *WIFI_CACHE_NAMESPACE = "wifi";
+const char *WIFI_CACHE_KEY = "cache";
+
+// Bits of the connection event group
+const EventBits_t WIFI_CONNECTED_BIT = BIT0;
+const EventBits_t WIFI_FAILED_BIT = BIT1;
+
+EventGroupHandle_t wifiEvents = nullptr;
+const char *wifiSsid = nullptr;
+const char *wifiPassword = nullptr;
+WifiCache wifiCache = {};
+bool fastConnectInProgress = false;
+
+// Link state as last seen by maintainWifi(), and the listeners to notify
+bool linkUp = false;
+WifiListener wifiListeners[MAX_WIFI_LISTENERS] = {};
+int wifiListenerCount = 0;
+
+// Restoring a lost link
+Backoff wifiBackoff(WIFI_RETRY_BASE_MS, WIFI_RETRY_MAX_MS);
+unsigned long wifiRetryStart = 0;
+uint32_t wifiRetryDelay = 0;
+
+// Load the cache, returning false if missing or for another network
+bool loadWifiCache(const char *ssid) {
+    Preferences preferences;
+    preferences.begin(WIFI_CACHE_NAMESPACE, true);
+    size_t length =
+        preferences.getBytes(WIFI_CACHE_KEY, &wifiCache, sizeof(wifiCache));
+    preferences.end();
+
+    wifiCache.ssid[sizeof(wifiCache.ssid) - 1] = '\0';
+    return length == sizeof(wifiCache) && strcmp(wifiCache.ssid, ssid) == 0 &&
+           wifiCache.ip != 0;
+}
+
+// Store the details of the current connection, if they changed,
+// so that NVS is only written when the access point or lease changes
+void saveWifiCache() {
+    WifiCache current = {};
+    strncpy(current.ssid, wifiSsid, sizeof(current.ssid) - 1);
+    memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+    current.channel = WiFi.channel();
+    current.ip = WiFi.localIP();
+    current.gateway = WiFi.gatewayIP();
+    current.subnet = WiFi.subnetMask();
+    current.dns = WiFi.dnsIP();
+
+    if (memcmp(&current, &wifiCache, sizeof(current)) == 0) {
+        return;
+    }
+    wifiCache = current;
+
+    Preferences preferences;
+    preferences.begin(WIFI_CACHE_NAMESPACE, false);
+    preferences.putBytes(WIFI_CACHE_KEY, &wifiCache, sizeof(wifiCache));
+    preferences.end();
+}
+
+// Called by the Wi-Fi driver task
+void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            xEventGroupClearBits(wifiEvents, WIFI_FAILED_BIT);
+            xEventGroupSetBits(wifiEvents, WIFI_CONNECTED_BIT);
+            break;
+
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            xEventGroupClearBits(wifiEvents, WIFI_CONNECTED_BIT);
+            xEventGroupSetBits(wifiEvents, WIFI_FAILED_BIT);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Connect with a full scan and DHCP
+void beginFullConnect() {
+    fastConnectInProgress = false;
+    WiFi.disconnect();
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(wifiSsid, wifiPassword);
+}
+
+void beginWifi(const char *ssid, const char *password) {
+    wifiSsid = ssid;
+    wifiPassword = password;
+    if (wifiEvents == nullptr) {
+        wifiEvents = xEventGroupCreate();
+        WiFi.onEvent(onWifiEvent);
+    }
+    xEventGroupClearBits(wifiEvents, WIFI_CONNECTED_BIT | WIFI_FAILED_BIT);
+
+    // The driver would otherwise store the credentials in flash on every
+    // begin(); the cache below is written only when something changed
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);
+    WiFi.mode(WIFI_STA);
+    if (loadWifiCache(ssid)) {
+        // Fast path: reuse the IP configuration and go straight to the
+        // known access point and channel
+        fastConnectInProgress = true;
+        WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway),
+                    IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+        WiFi.begin(ssid, password, wifiCache.channel, wifiCache.bssid);
+    } else {
+        WiFi.begin(ssid, password);
+    }
+}
+
+bool waitForWifi(uint32_t timeoutMs) {
+    unsigned long waitStart = millis();
+
+    if (fastConnectInProgress) {
+        uint32_t fastTimeout = timeoutMs < WIFI_FAST_CONNECT_TIMEOUT_MS
+                                   ? timeoutMs
+                                   : WIFI_FAST_CONNECT_TIMEOUT_MS;
+        EventBits_t bits = xEventGroupWaitBits(
+            wifiEvents, WIFI_CONNECTED_BIT | WIFI_FAILED_BIT, pdFALSE,
+            pdFALSE, pdMS_TO_TICKS(fastTimeout));
+        if (bits & WIFI_CONNECTED_BIT) {
+            fastConnectInProgress = false;
+            linkUp = true;
+            saveWifiCache();
+            return true;
+        }
+
+        // The access point moved, changed channel or the lease is gone
+        LOG_WARN("Fast Wi-Fi connect failed, scanning...");
+        xEventGroupClearBits(wifiEvents, WIFI_FAILED_BIT);
+        beginFullConnect();
+    }
+
+    uint32_t elapsed = millis() - waitStart;
+    if (elapsed >= timeoutMs) {
+        return wifiConnected();
+    }
+    EventBits_t bits =
+        xEventGroupWaitBits(wifiEvents, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE,
+                            timeoutMs == portMAX_DELAY
+                                ? portMAX_DELAY
+                                : pdMS_TO_TICKS(timeoutMs - elapsed));
+    if (bits & WIFI_CONNECTED_BIT) {
+        linkUp = true;
+        saveWifiCache();
+        return true;
+    }
+    return false;
+}
+
+bool wifiConnected() {
+    return wifiEvents != nullptr &&
+           (xEventGroupGetBits(wifiEvents) & WIFI_CONNECTED_BIT) != 0;
+}
+
+void onWifiChange(WifiListener listener) {
+    if (wifiListenerCount < MAX_WIFI_LISTENERS) {
+        wifiListeners[wifiListenerCount++] = listener;
+    }
+}
+
+void maintainWifi() {
+    bool connected = wifiConnected();
+
+    if (connected != linkUp) {
+        linkUp = connected;
+        if (connected) {
+            LOG_INFO("Wi-Fi link restored");
+            wifiBackoff.reset();
+            saveWifiCache();
+        } else {
+            LOG_WARN("Wi-Fi link lost");
+            // Give the access point a moment before the first attempt
+            wifiRetryStart = millis();
+            wifiRetryDelay = wifiBackoff.nextDelay(esp_random());
+        }
+        for (int i = 0; i < wifiListenerCount; i++) {
+            wifiListeners[i](connected);
+        }
+    }
+
+    if (connected || millis() - wifiRetryStart < wifiRetryDelay) {
+        return;
+    }
+
+    // The first attempt reuses the current configuration, the next ones
+    // start over with a full scan and DHCP, in case the network changed
+    LOG_INFO("Reconnecting to Wi-Fi (attempt %u)...", wifiBackoff.attempts());
+    if (wifiBackoff.attempts() <= 1) {
+        WiFi.reconnect();
+    } else {
+        beginFullConnect();
+    }
+    wifiRetryStart = millis();
+    wifiRetryDelay = wifiBackoff.nextDelay(esp_random());
+}
@@ -0,0 +1,179 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of the history codec: every sample written to a
+ *              page must read back unchanged, at the limits of the value
+ *              range and across any jump of the clock.
+ *
+ *              pio test -e native -f test_history_codec
+ */
+
+#include <unity.h>
+
+#include "history_codec.h"
+
+void setUp() {}
+void tearDown() {}
+
+struct Sample {
+    uint32_t epoch;
+    int16_t temperature;
+    int16_t humidity;
+};
+
+uint8_t page[HISTORY_PAGE_DATA_SIZE];
+
+// Encode `samples` after the first one, as the store does, and decode
+// them back. Returns how many came back unchanged.
+size_t roundTrip(const Sample *samples, size_t count) {
+    HistoryCursor cursor = {samples[0].epoch, 0, samples[0].temperature,
+                            samples[0].humidity};
+    HistoryCursor first = cursor;
+    BitWriter writer(page, sizeof(page));
+    for (size_t i = 1; i < count; i++) {
+        if (!encodeHistorySample(writer, cursor, samples[i].epoch,
+                                 samples[i].temperature,
+                                 samples[i].humidity)) {
+            return 0;
+        }
+    }
+
+    BitReader reader(page, writer.bitsWritten());
+    cursor = first;
+    size_t matching = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (!decodeHistorySample(reader, cursor) ||
+            cursor.epoch != samples[i].epoch ||
+            cursor.temperature != samples[i].temperature ||
+            cursor.humidity != samples[i].humidity) {
+            break;
+        }
+        matching++;
+    }
+    // Nothing may follow the last sample
+    if (decodeHistorySample(reader, cursor)) {
+        return 0;
+    }
+    return matching;
+}
+
+void test_page_layout() {
+    TEST_ASSERT_EQUAL_UINT(HISTORY_PAGE_SIZE,
+                           HISTORY_PAGE_HEADER_SIZE + HISTORY_PAGE_DATA_SIZE);
+    TEST_ASSERT_TRUE(HISTORY_PAGE_DATA_SIZE * 8 >= HISTORY_MAX_SAMPLE_BITS);
+}
+
+void test_steady_readings_cost_three_bits() {
+    HistoryCursor cursor = {1700000000, 3, 215, 402};
+    BitWriter writer(page, sizeof(page));
+    for (uint32_t i = 1; i <= 10; i++) {
+        TEST_ASSERT_TRUE(encodeHistorySample(writer, cursor,
+                                             1700000000 + 3 * i, 215, 402));
+    }
+    TEST_ASSERT_EQUAL_UINT(30, writer.bitsWritten());
+}
+
+void test_round_trip_of_small_changes() {
+    const Sample samples[] = {
+        {1700000000, 215, 402}, {1700000003, 216, 401},
+        {1700000006, 216, 401}, {1700000009, 208, 410},
+        {1700000012, 330, 250}, {1700000016, -15, 990},
+    };
+    const size_t count = sizeof(samples) / sizeof(samples[0]);
+    TEST_ASSERT_EQUAL_UINT(count, roundTrip(samples, count));
+}
+
+void test_round_trip_at_int16_limits() {
+    const Sample samples[] = {
+        {1700000000, 0, 0},
+        {1700000003, INT16_MAX, INT16_MIN},
+        {1700000006, INT16_MIN, INT16_MAX},
+        {1700000009, INT16_MIN, INT16_MAX},
+        {1700000012, INT16_MIN + 7, INT16_MAX - 8},
+        {1700000015, INT16_MAX, INT16_MIN},
+        {1700000018, INT16_MAX - 127, INT16_MIN + 128},
+        {1700000021, -1, 1},
+    };
+    const size_t count = sizeof(samples) / sizeof(samples[0]);
+    TEST_ASSERT_EQUAL_UINT(count, roundTrip(samples, count));
+}
+
+// Every width of the delta-of-delta encoding, just inside and outside of
+// its range
+void test_round_trip_of_every_time_width() {
+    const int32_t steps[] = {63,   64,    -64,    -65,     2047,    2048,
+                             -2048, -2049, 524287, 524288, -524288, -524289};
+    Sample samples[sizeof(steps) / sizeof(steps[0]) + 2];
+    samples[0] = {1700000000, 200, 400};
+    samples[1] = {1700000003, 200, 400};
+    int32_t delta = 3;
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        delta += steps[i];
+        samples[i + 2] = {samples[i + 1].epoch + delta, 200, 400};
+    }
+    const size_t count = sizeof(samples) / sizeof(samples[0]);
+    TEST_ASSERT_EQUAL_UINT(count, roundTrip(samples, count));
+}
+
+// The clock may be set far forward and back again, e.g. by a bad NTP
+// answer: the deltas and their difference then exceed 32 bits signed
+void test_round_trip_of_large_time_jumps() {
+    const Sample samples[] = {
+        {1700000000, 215, 402}, {1700000003, 215, 402},
+        {4000000000u, 215, 402}, {1700000006, 215, 402},
+        {4294967295u, 214, 403}, {0, 214, 403},
+        {4294967295u, 213, 404}, {1700000009, 213, 404},
+        {1700000012, 213, 404},
+    };
+    const size_t count = sizeof(samples) / sizeof(samples[0]);
+    TEST_ASSERT_EQUAL_UINT(count, roundTrip(samples, count));
+}
+
+void test_encoder_stops_before_the_end_of_the_page() {
+    HistoryCursor cursor = {1700000000, 0, 0, 0};
+    BitWriter writer(page, sizeof(page));
+    size_t written = 0;
+    // The worst case for every sample
+    while (encodeHistorySample(writer, cursor,
+                               written % 2 ? 1700000000 : 4000000000u,
+                               written % 2 ? INT16_MAX : INT16_MIN,
+                               written % 2 ? INT16_MIN : INT16_MAX)) {
+        written++;
+    }
+    TEST_ASSERT_EQUAL_UINT(sizeof(page) * 8 / HISTORY_MAX_SAMPLE_BITS,
+                           written);
+    TEST_ASSERT_TRUE(writer.remaining() < HISTORY_MAX_SAMPLE_BITS);
+
+    size_t bits = writer.bitsWritten();
+    HistoryCursor full = cursor;
+    TEST_ASSERT_FALSE(encodeHistorySample(writer, cursor, 1, 1, 1));
+    TEST_ASSERT_EQUAL_UINT(bits, writer.bitsWritten());
+    TEST_ASSERT_EQUAL_UINT32(full.epoch, cursor.epoch);
+}
+
+void test_decoder_stops_at_a_truncated_sample() {
+    HistoryCursor cursor = {1700000000, 3, 215, 402};
+    BitWriter writer(page, sizeof(page));
+    encodeHistorySample(writer, cursor, 1700000003, 215, 402);
+    encodeHistorySample(writer, cursor, 1800000000, INT16_MAX, INT16_MIN);
+
+    BitReader reader(page, writer.bitsWritten() - 1);
+    cursor = {1700000000, 3, 215, 402};
+    TEST_ASSERT_TRUE(decodeHistorySample(reader, cursor));
+    HistoryCursor last = cursor;
+    TEST_ASSERT_FALSE(decodeHistorySample(reader, cursor));
+    TEST_ASSERT_EQUAL_UINT32(last.epoch, cursor.epoch);
+    TEST_ASSERT_EQUAL_INT16(last.temperature, cursor.temperature);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_page_layout);
+    RUN_TEST(test_steady_readings_cost_three_bits);
+    RUN_TEST(test_round_trip_of_small_changes);
+    RUN_TEST(test_round_trip_at_int16_limits);
+    RUN_TEST(test_round_trip_of_every_time_width);
+    RUN_TEST(test_round_trip_of_large_time_jumps);
+    RUN_TEST(test_encoder_stops_before_the_end_of_the_page);
+    RUN_TEST(test_decoder_stops_at_a_truncated_sample);
+    return UNITY_END();
+}
@@ -0,0 +1,233 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of the reading and rollup encoders, JSON and
+ *              CBOR, including buffers that are too small, and of the
+ *              JSON lookups used for the MQTT config.
+ *
+ *              pio test -e native -f test_payload
+ */
+
+#include <unity.h>
+
+#include <string.h>
+
+#include "payload.h"
+
+void setUp() {}
+void tearDown() {}
+
+SensorSnapshot testReading() {
+    SensorSnapshot reading = {};
+    reading.avgTemperature = 21.5f;
+    reading.avgHumidity = 40.25f;
+    reading.rawTemperature = 22.0f;
+    reading.rawHumidity = 40.0f;
+    reading.epoch = 1700000000;
+    reading.sampleCount = 42;
+    reading.sensorOk = true;
+    reading.sensor = 1;
+    return reading;
+}
+
+Rollup testRollup() {
+    Rollup rollup = {};
+    rollup.reset(1700000000);
+    rollup.add(21.0f, 40.0f);
+    rollup.add(22.0f, 42.0f);
+    return rollup;
+}
+
+const char *READING_JSON =
+    "{\"s\":1,\"seq\":42,\"ts\":1700000000,\"t\":21.50,\"h\":40.25,"
+    "\"rt\":22.0,\"rh\":40.0}";
+
+// {"s":1,"seq":42,"ts":1700000000,"t":21.5,"h":40.25,"rt":22.0,"rh":40.0}
+const uint8_t READING_CBOR[] = {
+    0xA7,                                      // map(7)
+    0x61, 's', 0x01,                           // "s": 1
+    0x63, 's', 'e', 'q', 0x18, 0x2A,           // "seq": 42
+    0x62, 't', 's', 0x1A, 0x65, 0x53, 0xF1, 0x00,  // "ts": 1700000000
+    0x61, 't', 0xFA, 0x41, 0xAC, 0x00, 0x00,   // "t": 21.5
+    0x61, 'h', 0xFA, 0x42, 0x21, 0x00, 0x00,   // "h": 40.25
+    0x62, 'r', 't', 0xFA, 0x41, 0xB0, 0x00, 0x00,  // "rt": 22.0
+    0x62, 'r', 'h', 0xFA, 0x42, 0x20, 0x00, 0x00,  // "rh": 40.0
+};
+
+const char *ROLLUP_JSON =
+    "{\"s\":0,\"ts\":1700000000,\"p\":3600,\"n\":2,\"tmin\":21.0,"
+    "\"tavg\":21.50,\"tmax\":22.0,\"hmin\":40.0,\"havg\":41.00,"
+    "\"hmax\":42.0}";
+
+void test_reading_json() {
+    char buffer[MAX_PAYLOAD_SIZE];
+    size_t length = encodeReadingJson(testReading(), buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_UINT(strlen(READING_JSON), length);
+    TEST_ASSERT_EQUAL_STRING(READING_JSON, buffer);
+}
+
+// The JSON encoders need room for the NUL after the payload
+void test_reading_json_buffer_too_small() {
+    char buffer[MAX_PAYLOAD_SIZE];
+    size_t needed = strlen(READING_JSON) + 1;
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingJson(testReading(), buffer,
+                                                needed - 1));
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingJson(testReading(), buffer, 0));
+    TEST_ASSERT_EQUAL_UINT(needed - 1,
+                           encodeReadingJson(testReading(), buffer, needed));
+}
+
+void test_reading_cbor() {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    size_t length = encodeReadingCbor(testReading(), buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_UINT(sizeof(READING_CBOR), length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(READING_CBOR, buffer, sizeof(READING_CBOR));
+}
+
+void test_reading_cbor_buffer_too_small() {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    size_t needed = sizeof(READING_CBOR);
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingCbor(testReading(), buffer,
+                                                needed - 1));
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingCbor(testReading(), buffer, 0));
+    TEST_ASSERT_EQUAL_UINT(needed,
+                           encodeReadingCbor(testReading(), buffer, needed));
+}
+
+void test_readings_json_array() {
+    SensorSnapshot readings[2] = {testReading(), testReading()};
+    readings[1].sampleCount = 43;
+    char buffer[2 * MAX_PAYLOAD_SIZE];
+    size_t length = encodeReadingsJson(readings, 2, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_UINT(2 * strlen(READING_JSON) + 3, length);
+    TEST_ASSERT_EQUAL_UINT8('[', buffer[0]);
+    TEST_ASSERT_EQUAL_UINT8(',', buffer[strlen(READING_JSON) + 1]);
+    TEST_ASSERT_EQUAL_UINT8(']', buffer[length - 1]);
+    TEST_ASSERT_TRUE(strstr(buffer, "\"seq\":43") != nullptr);
+
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingsJson(readings, 2, buffer,
+                                                 length));
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingsJson(readings, 2, buffer, 1));
+}
+
+void test_readings_cbor_array() {
+    SensorSnapshot readings[2] = {testReading(), testReading()};
+    uint8_t buffer[2 * MAX_PAYLOAD_SIZE];
+    size_t length = encodeReadingsCbor(readings, 2, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_UINT(1 + 2 * sizeof(READING_CBOR), length);
+    TEST_ASSERT_EQUAL_HEX8(0x82, buffer[0]);  // array(2)
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(READING_CBOR,
+                                 buffer + 1 + sizeof(READING_CBOR),
+                                 sizeof(READING_CBOR));
+    TEST_ASSERT_EQUAL_UINT(0, encodeReadingsCbor(readings, 2, buffer,
+                                                 length - 1));
+}
+
+void test_rollup_json() {
+    char buffer[MAX_PAYLOAD_SIZE];
+    size_t length =
+        encodeRollupJson(0, 3600, testRollup(), buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_UINT(strlen(ROLLUP_JSON), length);
+    TEST_ASSERT_EQUAL_STRING(ROLLUP_JSON, buffer);
+    TEST_ASSERT_EQUAL_UINT(0, encodeRollupJson(0, 3600, testRollup(), buffer,
+                                               length));
+}
+
+// The widest values still fit in MAX_PAYLOAD_SIZE, as documented
+void test_rollup_json_fits_the_payload_size() {
+    Rollup rollup = {};
+    rollup.reset(4294967295u);
+    rollup.add(-40.0f, 100.0f);
+    rollup.add(-40.0f, 100.0f);
+    rollup.count = 4294967295u;
+    char buffer[MAX_PAYLOAD_SIZE];
+    TEST_ASSERT_TRUE(encodeRollupJson(255, 86400, rollup, buffer,
+                                      sizeof(buffer)) > 0);
+}
+
+void test_rollup_cbor() {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    size_t length =
+        encodeRollupCbor(0, 3600, testRollup(), buffer, sizeof(buffer));
+    // map(10), then "s": 0, "ts": 1700000000, "p": 3600, "n": 2
+    const uint8_t head[] = {0xAA, 0x61, 's',  0x00, 0x62, 't',  's',
+                            0x1A, 0x65, 0x53, 0xF1, 0x00, 0x61, 'p',
+                            0x19, 0x0E, 0x10, 0x61, 'n',  0x02};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(head, buffer, sizeof(head));
+    // Six float entries, of a 5 byte key and a 5 byte float each
+    TEST_ASSERT_EQUAL_UINT(sizeof(head) + 6 * 5 + 6 * 5, length);
+    // "tavg": 21.5
+    const uint8_t mean[] = {0x64, 't', 'a', 'v', 'g', 0xFA,
+                            0x41, 0xAC, 0x00, 0x00};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(mean, buffer + sizeof(head) + 10,
+                                 sizeof(mean));
+
+    TEST_ASSERT_EQUAL_UINT(0, encodeRollupCbor(0, 3600, testRollup(), buffer,
+                                               length - 1));
+    TEST_ASSERT_EQUAL_UINT(length, encodeRollupCbor(0, 3600, testRollup(),
+                                                    buffer, length));
+}
+
+void test_find_json_number() {
+    float value = 0;
+    TEST_ASSERT_TRUE(findJsonNumber("{\"humidity\": 0.5}", "humidity", value));
+    TEST_ASSERT_EQUAL_FLOAT(0.5f, value);
+    TEST_ASSERT_FALSE(findJsonNumber("{\"humidity\":\"x\"}", "humidity",
+                                     value));
+    TEST_ASSERT_FALSE(findJsonNumber("{\"temperature\":1}", "humidity",
+                                     value));
+}
+
+// A string value equal to the key is not the key
+void test_find_json_skips_values_equal_to_the_key() {
+    float number = 0;
+    TEST_ASSERT_TRUE(findJsonNumber("{\"name\":\"window\",\"window\":2}",
+                                    "window", number));
+    TEST_ASSERT_EQUAL_FLOAT(2.0f, number);
+
+    char text[16];
+    TEST_ASSERT_TRUE(findJsonString("{\"a\":\"url\",\"url\" : \"http://x\"}",
+                                    "url", text, sizeof(text)));
+    TEST_ASSERT_EQUAL_STRING("http://x", text);
+}
+
+void test_find_json_unsigned() {
+    uint32_t value = 0;
+    TEST_ASSERT_TRUE(findJsonUnsigned("{\"window\":16777217}", "window",
+                                      value));
+    TEST_ASSERT_EQUAL_UINT32(16777217u, value);
+    TEST_ASSERT_TRUE(findJsonUnsigned("{\"w\":4294967295}", "w", value));
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, value);
+
+    TEST_ASSERT_FALSE(findJsonUnsigned("{\"w\":4294967296}", "w", value));
+    TEST_ASSERT_FALSE(findJsonUnsigned("{\"w\":-1}", "w", value));
+    TEST_ASSERT_FALSE(findJsonUnsigned("{\"w\":30.5}", "w", value));
+    TEST_ASSERT_FALSE(findJsonUnsigned("{\"w\":1e3}", "w", value));
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, value);  // Left untouched
+}
+
+void test_find_json_string_too_long() {
+    char text[4];
+    TEST_ASSERT_FALSE(findJsonString("{\"k\":\"abcd\"}", "k", text,
+                                     sizeof(text)));
+    TEST_ASSERT_TRUE(findJsonString("{\"k\":\"abc\"}", "k", text,
+                                    sizeof(text)));
+    TEST_ASSERT_EQUAL_STRING("abc", text);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reading_json);
+    RUN_TEST(test_reading_json_buffer_too_small);
+    RUN_TEST(test_reading_cbor);
+    RUN_TEST(test_reading_cbor_buffer_too_small);
+    RUN_TEST(test_readings_json_array);
+    RUN_TEST(test_readings_cbor_array);
+    RUN_TEST(test_rollup_json);
+    RUN_TEST(test_rollup_json_fits_the_payload_size);
+    RUN_TEST(test_rollup_cbor);
+    RUN_TEST(test_find_json_number);
+    RUN_TEST(test_find_json_skips_values_equal_to_the_key);
+    RUN_TEST(test_find_json_unsigned);
+    RUN_TEST(test_find_json_string_too_long);
+    return UNITY_END();
+}
@@ -0,0 +1,122 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of RingWindow, the buffer behind the window
+ *              filters: mean, variance, eviction and resize.
+ *
+ *              pio test -e native -f test_ring_window
+ */
+
+#include <unity.h>
+
+#include "ring_window.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_window_reads_zero() {
+    RingWindow<float, 4> window;
+    TEST_ASSERT_TRUE(window.empty());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.mean());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.variance());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, window.back());
+}
+
+void test_mean_and_variance() {
+    RingWindow<float, 8> window;
+    const float values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+    for (float value : values) {
+        window.push(value);
+    }
+    TEST_ASSERT_TRUE(window.full());
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, window.mean());
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, window.variance());
+}
+
+void test_full_window_drops_the_oldest() {
+    RingWindow<int, 3> window;
+    for (int value = 1; value <= 5; value++) {
+        window.push(value);
+    }
+    TEST_ASSERT_EQUAL_UINT(3, window.size());
+    TEST_ASSERT_EQUAL_INT(3, window[0]);
+    TEST_ASSERT_EQUAL_INT(5, window.back());
+    TEST_ASSERT_EQUAL_INT(12, window.total());
+}
+
+// The sums are rebuilt once per wrap around, so they must not drift over
+// many pushes of values that do not add up exactly in float
+void test_sums_do_not_drift() {
+    RingWindow<float, 10> window;
+    for (int i = 0; i < 100000; i++) {
+        window.push(i % 2 == 0 ? 1000.1f : 0.3f);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 500.2f, window.mean());
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, 249900.01f, window.variance());
+}
+
+void test_constant_readings_have_no_variance() {
+    RingWindow<float, 5> window;
+    for (int i = 0; i < 12; i++) {
+        window.push(21.3f);
+    }
+    TEST_ASSERT_TRUE(window.variance() >= 0.0f);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.0f, window.variance());
+}
+
+void test_shrink_keeps_the_newest() {
+    RingWindow<int, 6> window;
+    for (int value = 1; value <= 6; value++) {
+        window.push(value);
+    }
+    window.resize(2);
+    TEST_ASSERT_EQUAL_UINT(2, window.length());
+    TEST_ASSERT_EQUAL_UINT(2, window.size());
+    TEST_ASSERT_EQUAL_INT(5, window[0]);
+    TEST_ASSERT_EQUAL_INT(6, window[1]);
+    TEST_ASSERT_EQUAL_INT(11, window.total());
+
+    window.push(7);
+    TEST_ASSERT_EQUAL_INT(6, window[0]);
+    TEST_ASSERT_EQUAL_INT(7, window.back());
+}
+
+void test_grow_keeps_the_readings() {
+    RingWindow<int, 6> window;
+    window.resize(2);
+    for (int value = 1; value <= 4; value++) {
+        window.push(value);
+    }
+    window.resize(6);
+    TEST_ASSERT_EQUAL_UINT(2, window.size());
+    TEST_ASSERT_FALSE(window.full());
+    window.push(5);
+    TEST_ASSERT_EQUAL_INT(3, window[0]);
+    TEST_ASSERT_EQUAL_INT(5, window.back());
+    TEST_ASSERT_EQUAL_INT(12, window.total());
+}
+
+void test_resize_is_clamped() {
+    RingWindow<int, 4> window;
+    window.resize(0);
+    TEST_ASSERT_EQUAL_UINT(1, window.length());
+    window.push(1);
+    window.push(2);
+    TEST_ASSERT_EQUAL_UINT(1, window.size());
+    TEST_ASSERT_EQUAL_INT(2, window.back());
+
+    window.resize(100);
+    TEST_ASSERT_EQUAL_UINT(4, window.length());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_window_reads_zero);
+    RUN_TEST(test_mean_and_variance);
+    RUN_TEST(test_full_window_drops_the_oldest);
+    RUN_TEST(test_sums_do_not_drift);
+    RUN_TEST(test_constant_readings_have_no_variance);
+    RUN_TEST(test_shrink_keeps_the_newest);
+    RUN_TEST(test_grow_keeps_the_readings);
+    RUN_TEST(test_resize_is_clamped);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of Rollup: adding readings and merging buckets.
+ *
+ *              pio test -e native -f test_rollup
+ */
+
+#include <unity.h>
+
+#include "rollup.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_rollup() {
+    Rollup rollup = {};
+    rollup.reset(3600);
+    TEST_ASSERT_EQUAL_UINT32(3600, rollup.start);
+    TEST_ASSERT_EQUAL_UINT32(0, rollup.count);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, rollup.meanTemperature());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, rollup.meanHumidity());
+}
+
+void test_add() {
+    Rollup rollup = {};
+    rollup.add(21.0f, 40.0f);
+    rollup.add(23.0f, 38.0f);
+    rollup.add(19.0f, 45.0f);
+    TEST_ASSERT_EQUAL_UINT32(3, rollup.count);
+    TEST_ASSERT_EQUAL_FLOAT(19.0f, rollup.minTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(23.0f, rollup.maxTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(21.0f, rollup.meanTemperature());
+    TEST_ASSERT_EQUAL_FLOAT(38.0f, rollup.minHumidity);
+    TEST_ASSERT_EQUAL_FLOAT(45.0f, rollup.maxHumidity);
+    TEST_ASSERT_EQUAL_FLOAT(41.0f, rollup.meanHumidity());
+}
+
+// The first reading sets min and max, even below zero
+void test_add_negative_readings() {
+    Rollup rollup = {};
+    rollup.add(-5.0f, 10.0f);
+    rollup.add(-2.0f, 12.0f);
+    TEST_ASSERT_EQUAL_FLOAT(-5.0f, rollup.minTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(-2.0f, rollup.maxTemperature);
+}
+
+void test_reset_forgets_the_readings() {
+    Rollup rollup = {};
+    rollup.add(30.0f, 90.0f);
+    rollup.reset(7200);
+    rollup.add(20.0f, 50.0f);
+    TEST_ASSERT_EQUAL_UINT32(7200, rollup.start);
+    TEST_ASSERT_EQUAL_UINT32(1, rollup.count);
+    TEST_ASSERT_EQUAL_FLOAT(20.0f, rollup.maxTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(50.0f, rollup.maxHumidity);
+}
+
+// Merging hours gives the same day as adding their readings to it
+void test_merge_matches_add() {
+    const float temperatures[] = {18.0f, 22.5f, 20.0f, 25.0f, 17.5f, 21.0f};
+    const float humidities[] = {55.0f, 48.0f, 50.0f, 40.0f, 60.0f, 52.0f};
+    Rollup day = {};
+    Rollup first = {};
+    Rollup second = {};
+    for (int i = 0; i < 6; i++) {
+        day.add(temperatures[i], humidities[i]);
+        (i < 3 ? first : second).add(temperatures[i], humidities[i]);
+    }
+
+    Rollup merged = {};
+    merged.merge(first);
+    merged.merge(second);
+    TEST_ASSERT_EQUAL_UINT32(day.count, merged.count);
+    TEST_ASSERT_EQUAL_FLOAT(day.minTemperature, merged.minTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(day.maxTemperature, merged.maxTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(day.meanTemperature(), merged.meanTemperature());
+    TEST_ASSERT_EQUAL_FLOAT(day.minHumidity, merged.minHumidity);
+    TEST_ASSERT_EQUAL_FLOAT(day.maxHumidity, merged.maxHumidity);
+    TEST_ASSERT_EQUAL_FLOAT(day.meanHumidity(), merged.meanHumidity());
+}
+
+void test_merge_empty_changes_nothing() {
+    Rollup rollup = {};
+    rollup.add(21.0f, 40.0f);
+    Rollup empty = {};
+    empty.reset(0);
+    rollup.merge(empty);
+    TEST_ASSERT_EQUAL_UINT32(1, rollup.count);
+    TEST_ASSERT_EQUAL_FLOAT(21.0f, rollup.minTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(21.0f, rollup.maxTemperature);
+}
+
+// Merging into an empty bucket takes min and max from the other one, not
+// from the zeroed fields
+void test_merge_into_empty() {
+    Rollup hour = {};
+    hour.add(25.0f, 60.0f);
+    hour.add(26.0f, 61.0f);
+    Rollup day = {};
+    day.reset(86400);
+    day.merge(hour);
+    TEST_ASSERT_EQUAL_UINT32(86400, day.start);
+    TEST_ASSERT_EQUAL_UINT32(2, day.count);
+    TEST_ASSERT_EQUAL_FLOAT(25.0f, day.minTemperature);
+    TEST_ASSERT_EQUAL_FLOAT(60.0f, day.minHumidity);
+    TEST_ASSERT_EQUAL_FLOAT(25.5f, day.meanTemperature());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_rollup);
+    RUN_TEST(test_add);
+    RUN_TEST(test_add_negative_readings);
+    RUN_TEST(test_reset_forgets_the_readings);
+    RUN_TEST(test_merge_matches_add);
+    RUN_TEST(test_merge_empty_changes_nothing);
+    RUN_TEST(test_merge_into_empty);
+    return UNITY_END();
+}
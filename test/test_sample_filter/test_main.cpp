@@ -0,0 +1,161 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of the reading filters and the spike gate.
+ *
+ *              pio test -e native -f test_sample_filter
+ */
+
+#include <unity.h>
+
+#include "sample_filter.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_filters_read_zero_until_the_first_reading() {
+    MeanFilter<float, 4> mean;
+    MedianFilter<float, 4> median;
+    EmaFilter<float> ema(0.5f);
+    KalmanFilter<float> kalman(0.01f, 1.0f);
+    TEST_ASSERT_TRUE(mean.empty() && median.empty());
+    TEST_ASSERT_TRUE(ema.empty() && kalman.empty());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, median.value());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, ema.value());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, kalman.value());
+}
+
+void test_mean_filter() {
+    MeanFilter<float, 3> filter;
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, filter.update(3.0f));
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, filter.update(5.0f));
+    filter.update(7.0f);
+    TEST_ASSERT_EQUAL_FLOAT(7.0f, filter.update(9.0f));
+}
+
+void test_median_filter_odd_and_even_counts() {
+    MedianFilter<float, 5> filter;
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, filter.update(10.0f));
+    TEST_ASSERT_EQUAL_FLOAT(15.0f, filter.update(20.0f));
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, filter.update(1.0f));
+    TEST_ASSERT_EQUAL_FLOAT(7.5f, filter.update(5.0f));
+}
+
+void test_median_filter_ignores_an_outlier() {
+    MedianFilter<float, 5> filter;
+    const float values[] = {21.0f, 21.2f, 85.0f, 21.1f, 20.9f};
+    for (float value : values) {
+        filter.update(value);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(21.1f, filter.value());
+}
+
+// Once full, the oldest reading leaves the sorted copy as well
+void test_median_filter_slides() {
+    MedianFilter<float, 3> filter;
+    filter.update(1.0f);
+    filter.update(2.0f);
+    filter.update(3.0f);
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, filter.update(4.0f));
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, filter.update(5.0f));
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, filter.update(100.0f));
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, filter.update(0.0f));
+}
+
+void test_median_filter_with_duplicates() {
+    MedianFilter<float, 3> filter;
+    filter.update(2.0f);
+    filter.update(2.0f);
+    filter.update(1.0f);
+    TEST_ASSERT_EQUAL_FLOAT(2.0f, filter.update(3.0f));
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, filter.update(3.0f));
+}
+
+void test_median_filter_resize() {
+    MedianFilter<float, 5> filter;
+    const float values[] = {9.0f, 1.0f, 8.0f, 2.0f, 7.0f};
+    for (float value : values) {
+        filter.update(value);
+    }
+    filter.resize(3);  // Keeps 8, 2, 7
+    TEST_ASSERT_EQUAL_FLOAT(7.0f, filter.value());
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, filter.update(3.0f));
+}
+
+void test_ema_filter() {
+    EmaFilter<float> filter(0.25f);
+    TEST_ASSERT_EQUAL_FLOAT(20.0f, filter.update(20.0f));
+    TEST_ASSERT_EQUAL_FLOAT(21.0f, filter.update(24.0f));
+    TEST_ASSERT_EQUAL_FLOAT(20.75f, filter.update(20.0f));
+}
+
+void test_ema_filter_with_alpha_one_follows_the_readings() {
+    EmaFilter<float> filter(1.0f);
+    filter.update(5.0f);
+    TEST_ASSERT_EQUAL_FLOAT(-3.0f, filter.update(-3.0f));
+}
+
+void test_kalman_filter_starts_at_the_first_reading() {
+    KalmanFilter<float> filter(0.01f, 1.0f);
+    TEST_ASSERT_EQUAL_FLOAT(22.0f, filter.update(22.0f));
+    TEST_ASSERT_FALSE(filter.empty());
+}
+
+void test_kalman_filter_converges() {
+    KalmanFilter<float> filter(0.001f, 1.0f);
+    filter.update(10.0f);
+    for (int i = 0; i < 500; i++) {
+        filter.update(i % 2 == 0 ? 19.0f : 21.0f);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.2f, 20.0f, filter.value());
+}
+
+// A step moves the estimate towards the new level, but not all the way
+void test_kalman_filter_smooths_a_step() {
+    KalmanFilter<float> filter(0.01f, 1.0f);
+    for (int i = 0; i < 100; i++) {
+        filter.update(20.0f);
+    }
+    float estimate = filter.update(30.0f);
+    TEST_ASSERT_TRUE(estimate > 20.0f);
+    TEST_ASSERT_TRUE(estimate < 25.0f);
+}
+
+void test_spike_gate() {
+    SpikeGate<float> gate(5.0f);
+    TEST_ASSERT_FALSE(gate.isSpike(100.0f));  // Nothing accepted yet
+    gate.accept(20.0f);
+    TEST_ASSERT_FALSE(gate.isSpike(25.0f));
+    TEST_ASSERT_FALSE(gate.isSpike(15.0f));
+    TEST_ASSERT_TRUE(gate.isSpike(25.5f));
+    TEST_ASSERT_TRUE(gate.isSpike(14.0f));
+    TEST_ASSERT_EQUAL_FLOAT(20.0f, gate.lastAccepted());
+
+    gate.accept(25.5f);
+    TEST_ASSERT_EQUAL_FLOAT(25.5f, gate.lastAccepted());
+    TEST_ASSERT_FALSE(gate.isSpike(30.0f));
+}
+
+void test_spike_gate_disabled_by_zero() {
+    SpikeGate<float> gate(0.0f);
+    gate.accept(20.0f);
+    TEST_ASSERT_FALSE(gate.isSpike(1000.0f));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_filters_read_zero_until_the_first_reading);
+    RUN_TEST(test_mean_filter);
+    RUN_TEST(test_median_filter_odd_and_even_counts);
+    RUN_TEST(test_median_filter_ignores_an_outlier);
+    RUN_TEST(test_median_filter_slides);
+    RUN_TEST(test_median_filter_with_duplicates);
+    RUN_TEST(test_median_filter_resize);
+    RUN_TEST(test_ema_filter);
+    RUN_TEST(test_ema_filter_with_alpha_one_follows_the_readings);
+    RUN_TEST(test_kalman_filter_starts_at_the_first_reading);
+    RUN_TEST(test_kalman_filter_converges);
+    RUN_TEST(test_kalman_filter_smooths_a_step);
+    RUN_TEST(test_spike_gate);
+    RUN_TEST(test_spike_gate_disabled_by_zero);
+    return UNITY_END();
+}
@@ -0,0 +1,96 @@
+/*
+ * File: test_main.cpp
+ * Description: Unit tests of SpscQueue: order, the full and empty cases
+ *              and the indices wrapping around.
+ *
+ *              pio test -e native -f test_spsc_queue
+ */
+
+#include <unity.h>
+
+#include "spsc_queue.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_new_queue_is_empty() {
+    SpscQueue<int, 4> queue;
+    TEST_ASSERT_TRUE(queue.empty());
+    TEST_ASSERT_EQUAL_UINT(0, queue.size());
+    TEST_ASSERT_EQUAL_UINT(4, queue.capacity());
+}
+
+void test_pop_on_empty_leaves_the_value() {
+    SpscQueue<int, 4> queue;
+    int value = 42;
+    TEST_ASSERT_FALSE(queue.pop(value));
+    TEST_ASSERT_EQUAL_INT(42, value);
+    queue.pop();  // Does nothing
+    TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_fifo_order() {
+    SpscQueue<int, 4> queue;
+    TEST_ASSERT_TRUE(queue.push(1));
+    TEST_ASSERT_TRUE(queue.push(2));
+    TEST_ASSERT_TRUE(queue.push(3));
+    TEST_ASSERT_EQUAL_INT(1, queue.front());
+
+    int value = 0;
+    for (int expected = 1; expected <= 3; expected++) {
+        TEST_ASSERT_TRUE(queue.pop(value));
+        TEST_ASSERT_EQUAL_INT(expected, value);
+    }
+    TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_push_on_full_drops_the_value() {
+    SpscQueue<int, 4> queue;
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(queue.push(i));
+    }
+    TEST_ASSERT_EQUAL_UINT(4, queue.size());
+    TEST_ASSERT_FALSE(queue.push(99));
+    TEST_ASSERT_EQUAL_UINT(4, queue.size());
+
+    // The queued elements are untouched, and a slot frees up after a pop
+    int value = -1;
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL_INT(0, value);
+    TEST_ASSERT_TRUE(queue.push(4));
+    for (int expected = 1; expected <= 4; expected++) {
+        TEST_ASSERT_TRUE(queue.pop(value));
+        TEST_ASSERT_EQUAL_INT(expected, value);
+    }
+    TEST_ASSERT_FALSE(queue.pop(value));
+}
+
+// Many laps around the slots, with the queue alternately full and empty
+void test_many_laps() {
+    SpscQueue<uint32_t, 8> queue;
+    uint32_t next = 0;
+    uint32_t expected = 0;
+    for (int lap = 0; lap < 1000; lap++) {
+        while (queue.push(next)) {
+            next++;
+        }
+        TEST_ASSERT_EQUAL_UINT(8, queue.size());
+        uint32_t value = 0;
+        while (queue.pop(value)) {
+            TEST_ASSERT_EQUAL_UINT32(expected, value);
+            expected++;
+        }
+        TEST_ASSERT_TRUE(queue.empty());
+    }
+    TEST_ASSERT_EQUAL_UINT32(8000, expected);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_new_queue_is_empty);
+    RUN_TEST(test_pop_on_empty_leaves_the_value);
+    RUN_TEST(test_fifo_order);
+    RUN_TEST(test_push_on_full_drops_the_value);
+    RUN_TEST(test_many_laps);
+    return UNITY_END();
+}